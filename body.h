@@ -4,6 +4,12 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/norm.hpp>
 #include <vector>
+#include <cstdint>
+#include <random>
+#include <algorithm>
+#include <cstring>
+#include "philox.h"
+#include "parallel.h"
 
 extern const float X_MEAN;
 extern const float X_STD;
@@ -30,6 +36,7 @@ public:
     glm::vec3 color;
     float mass;
     float radius;
+    uint32_t id = 0; // Stable external ID, survives reordering
 
     Body(const glm::vec2 &position,
          const glm::vec2 &velocity,
@@ -53,68 +60,170 @@ public:
     }
 };
 
-void initializeBodies(std::vector<Body> &bodies, int n)
+// Shape of the initial distribution. The disks orbit the sun; the Plummer
+// sphere has no sun and holds mass_sun itself.
+enum class InitialPreset
 {
-    Body sun(
-        glm::vec2(0.0f, 0.0f),
-        glm::vec2(0.0f, 0.0f),
-        glm::vec3(1.0f, 1.0f, 0.0f),
-        MASS_SUN,
-        0.2f);
+    BimodalDisk, // Two Gaussian lobes either side of the sun, x_mean .. y_std
+    Plummer,     // Plummer sphere of scale radius `radius`, projected onto the plane
+    UniformDisk  // Uniform disk of radius `radius`
+};
+
+// Parameters of the initial bodies. They default to the executable's
+// X_MEAN .. MASS_SUN; ensembles vary them per run.
+struct InitialConditions
+{
+    InitialPreset preset = InitialPreset::BimodalDisk;
+    float x_mean = X_MEAN;
+    float x_std = X_STD;
+    float y_mean = Y_MEAN;
+    float y_std = Y_STD;
+    float radius = X_MEAN + 2.0f * X_STD;
+    float mass_sun = MASS_SUN;
+    uint64_t seed = 0; // 0 draws a seed from std::random_device
+};
+
+// Circular orbit around the sun, with the speed jittered by up to 5%
+glm::vec2 orbital_velocity(glm::vec2 position, float mass_sun, PhiloxStream &rng)
+{
+    const float multiplier = rng.uniform(0.95f, 1.05f);
+    const float distance = glm::length(position);
+    if (distance <= 0.001f)
+        return glm::vec2(0.0f);
+    const glm::vec2 perpendicular = glm::vec2(-position.y, position.x) / distance;
+    return std::sqrt(mass_sun / distance) * multiplier * perpendicular;
+}
+
+// Random unit vector in 3D projected onto the plane
+glm::vec2 projected_direction(PhiloxStream &rng)
+{
+    const float z = rng.uniform(-1.0f, 1.0f);
+    const float phi = 6.2831853f * rng.uniform();
+    return std::sqrt(std::max(0.0f, 1.0f - z * z)) * glm::vec2(std::cos(phi), std::sin(phi));
+}
+
+// Body i of the initial conditions. It depends only on (seed, i), so the
+// bodies can be generated in any order on any number of threads.
+Body initial_body(const InitialConditions &ic, uint64_t seed, uint32_t i)
+{
+    PhiloxStream rng(seed, i);
 
-    bodies.push_back(sun);
+    const float radius = rng.uniform(0.005f, 0.02f);
+    const float mass = rng.uniform(0.8f, 2.5f) * (radius * radius);
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    glm::vec2 position(0.0f);
+    glm::vec2 velocity(0.0f);
+    switch (ic.preset)
+    {
+    case InitialPreset::BimodalDisk:
+    {
+        // Either on right of sun or left of sun
+        const bool right = rng.uniform() < 0.5f;
+        position.x = rng.normal(right ? ic.x_mean : -ic.x_mean, ic.x_std);
+        position.y = rng.normal(ic.y_mean, ic.y_std);
+        velocity = orbital_velocity(position, ic.mass_sun, rng);
+        break;
+    }
+    case InitialPreset::UniformDisk:
+    {
+        const float r = ic.radius * std::sqrt(rng.uniform());
+        const float phi = 6.2831853f * rng.uniform();
+        position = r * glm::vec2(std::cos(phi), std::sin(phi));
+        velocity = orbital_velocity(position, ic.mass_sun, rng);
+        break;
+    }
+    case InitialPreset::Plummer:
+    {
+        // Aarseth, Henon & Wielen (1974) with mass_sun as the cluster mass,
+        // which initializeBodies() gives the bodies; the radius is cut at
+        // 10 scale radii to bound the tree
+        const float a = ic.radius;
+        float r = 0.0f;
+        do
+        {
+            const float m = 1.0f - rng.uniform(); // Enclosed mass fraction, (0, 1]
+            r = a / std::sqrt(std::pow(m, -2.0f / 3.0f) - 1.0f);
+        } while (!(r <= 10.0f * a));
+        position = r * projected_direction(rng);
+
+        float q = 0.0f;
+        float g = 0.0f;
+        do
+        {
+            q = rng.uniform();
+            g = 0.1f * rng.uniform();
+        } while (g > q * q * std::pow(1.0f - q * q, 3.5f));
+        const float escape = std::sqrt(2.0f * ic.mass_sun / a) * std::pow(1.0f + r * r / (a * a), -0.25f);
+        velocity = q * escape * projected_direction(rng);
+        break;
+    }
+    }
 
-    // Bimodal distribution
-    // Either on right of sun or left of sun
-    std::normal_distribution<float> x_distribution_1(X_MEAN, X_STD);
-    std::normal_distribution<float> x_distribution_2(-X_MEAN, X_STD);
-    std::bernoulli_distribution mix_x(0.5);
+    return Body(position, velocity, glm::vec3(1.0f, 1.0f, 1.0f), mass, radius);
+}
 
-    std::normal_distribution<float> y_distribution(Y_MEAN, Y_STD);
+// Append the sun, unless ic is a Plummer sphere, and n bodies drawn from
+// ic, then sort all bodies by distance from the origin and number their
+// ids. The result is identical for any thread count. Returns the seed used.
+uint64_t initializeBodies(std::vector<Body> &bodies, int n, const InitialConditions &ic)
+{
+    uint64_t seed = ic.seed;
+    if (seed == 0)
+    {
+        std::random_device rd;
+        seed = (static_cast<uint64_t>(rd()) << 32) | rd();
+    }
 
-    std::uniform_real_distribution<float> radius_distribution(0.005f, 0.02f);
-    std::uniform_real_distribution<float> density_distribution(0.8f, 2.5f);
+    Body sun(
+        glm::vec2(0.0f, 0.0f),
+        glm::vec2(0.0f, 0.0f),
+        glm::vec3(1.0f, 1.0f, 0.0f),
+        ic.mass_sun,
+        0.2f);
 
-    std::uniform_real_distribution<float> speed_multiplier(0.95f, 1.05f);
+    // A Plummer sphere is a cluster of its own: no sun, and the bodies
+    // share mass_sun, the mass its velocities are drawn for
+    const bool plummer = ic.preset == InitialPreset::Plummer;
+    const size_t first = bodies.size() + (plummer ? 0 : 1);
+    bodies.resize(first + std::max(n, 0), sun);
 
+#pragma omp parallel for schedule(static)
     for (int i = 0; i < n; i++)
     {
-        float radius = radius_distribution(gen);
-        float mass = (density_distribution(gen)) * (radius * radius);
+        bodies[first + i] = initial_body(ic, seed, static_cast<uint32_t>(i));
+        if (plummer)
+            bodies[first + i].mass = ic.mass_sun / n;
+    }
 
-        float x = mix_x(gen) ? x_distribution_1(gen) : x_distribution_2(gen);
-        float y = y_distribution(gen);
-        glm::vec2 position = {x, y};
+    // Sort the bodies by position to optimize calculations. Squared
+    // distances are non-negative, so their bit patterns sort as integers;
+    // the stable radix sort breaks ties by index.
+    std::vector<uint32_t> keys(bodies.size()), order(bodies.size());
+    std::vector<uint32_t> keys_tmp, order_tmp;
+    std::vector<size_t> hist;
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < bodies.size(); i++)
+    {
+        const float d_sq = glm::length2(bodies[i].position);
+        std::memcpy(&keys[i], &d_sq, sizeof(d_sq));
+        order[i] = static_cast<uint32_t>(i);
+    }
+    radix_sort_pairs(keys, order, keys_tmp, order_tmp, hist);
 
-        glm::vec2 velocity = {0.0f, 0.0f};
-        float distance = std::sqrt(x * x + y * y);
-        if (distance > 0.001)
-        {
-            glm::vec2 perpendicular = glm::normalize(glm::vec2(-y, x));
-            float orbitalSpeed = std::sqrt(MASS_SUN / distance);
-            orbitalSpeed *= speed_multiplier(gen);
-            velocity = orbitalSpeed * perpendicular;
-        }
-
-        Body b(
-            position,
-            velocity,
-            glm::vec3(1.0f, 1.0f, 1.0f),
-            mass,
-            radius);
-
-        bodies.push_back(b);
+    const std::vector<Body> unsorted = bodies;
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < bodies.size(); i++)
+    {
+        bodies[i] = unsorted[order[i]];
+        bodies[i].id = static_cast<uint32_t>(i);
     }
 
-    // Sort the bodies by position to optimize calculations
-    std::sort(bodies.begin(), bodies.end(),
-              [](const Body &a, const Body &b)
-              {
-                  return glm::length2(a.position) < glm::length2(b.position);
-              });
+    return seed;
+}
+
+uint64_t initializeBodies(std::vector<Body> &bodies, int n)
+{
+    return initializeBodies(bodies, n, InitialConditions());
 }
 
 Body merge_bodies(const Body &b1, const Body &b2)
@@ -126,7 +235,9 @@ Body merge_bodies(const Body &b1, const Body &b2)
     float new_radius = std::cbrt(std::pow(b1.radius, 3) + std::pow(b2.radius, 3));
     glm::vec3 new_color = b1.mass > b2.mass ? b1.color : b2.color;
 
-    return Body(new_position, new_velocity, new_color, new_mass, new_radius);
+    Body merged(new_position, new_velocity, new_color, new_mass, new_radius);
+    merged.id = b1.mass > b2.mass ? b1.id : b2.id;
+    return merged;
 }
 
 #endif
\ No newline at end of file
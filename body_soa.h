@@ -0,0 +1,273 @@
+#ifndef BODY_SOA_H
+#define BODY_SOA_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include "body.h"
+#include "parallel.h"
+
+// Structure-of-arrays body storage. Each physics field lives in its own
+// contiguous array so the simulation passes only stream the fields they
+// use; color is render-only and kept apart from the physics state.
+class BodySoA
+{
+public:
+    std::vector<float> x, y;
+    std::vector<float> vx, vy;
+    std::vector<float> ax, ay;
+    std::vector<float> mass;
+    std::vector<float> radius;
+    std::vector<uint32_t> id;
+    // Work of the body's last force evaluation, the load balancing cost model
+    std::vector<uint32_t> cost;
+
+    // Cold data, only read by render()
+    std::vector<glm::vec3> color;
+
+    size_t size() const noexcept { return x.size(); }
+    bool empty() const noexcept { return x.empty(); }
+
+    glm::vec2 position(size_t i) const { return glm::vec2(x[i], y[i]); }
+    glm::vec2 velocity(size_t i) const { return glm::vec2(vx[i], vy[i]); }
+
+    void resize(size_t n)
+    {
+        x.resize(n);
+        y.resize(n);
+        vx.resize(n);
+        vy.resize(n);
+        ax.resize(n);
+        ay.resize(n);
+        mass.resize(n);
+        radius.resize(n);
+        id.resize(n);
+        cost.resize(n);
+        color.resize(n);
+    }
+
+    void set(size_t i, const Body &b)
+    {
+        x[i] = b.position.x;
+        y[i] = b.position.y;
+        vx[i] = b.velocity.x;
+        vy[i] = b.velocity.y;
+        ax[i] = b.acceleration.x;
+        ay[i] = b.acceleration.y;
+        mass[i] = b.mass;
+        radius[i] = b.radius;
+        id[i] = b.id;
+        cost[i] = 0;
+        color[i] = b.color;
+    }
+
+    Body get(size_t i) const
+    {
+        Body b(position(i), velocity(i), color[i], mass[i], radius[i]);
+        b.acceleration = glm::vec2(ax[i], ay[i]);
+        b.id = id[i];
+        return b;
+    }
+
+    // Adapter from the std::vector<Body> API
+    void load(const std::vector<Body> &bodies)
+    {
+        resize(bodies.size());
+#pragma omp parallel for
+        for (size_t i = 0; i < bodies.size(); ++i)
+        {
+            set(i, bodies[i]);
+        }
+    }
+
+    // Adapter back to the std::vector<Body> API
+    void store(std::vector<Body> &bodies) const
+    {
+        const size_t n = size();
+        if (bodies.size() > n)
+            bodies.erase(bodies.begin() + n, bodies.end());
+        while (bodies.size() < n)
+            bodies.push_back(get(bodies.size()));
+
+#pragma omp parallel for
+        for (size_t i = 0; i < n; ++i)
+        {
+            bodies[i] = get(i);
+        }
+    }
+
+    // this[i] = src[order[i]] for every i
+    void gather(const BodySoA &src, const std::vector<uint32_t> &order)
+    {
+        resize(order.size());
+#pragma omp parallel for
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            const size_t j = order[i];
+            x[i] = src.x[j];
+            y[i] = src.y[j];
+            vx[i] = src.vx[j];
+            vy[i] = src.vy[j];
+            ax[i] = src.ax[j];
+            ay[i] = src.ay[j];
+            mass[i] = src.mass[j];
+            radius[i] = src.radius[j];
+            id[i] = src.id[j];
+            cost[i] = src.cost[j];
+            color[i] = src.color[j];
+        }
+    }
+
+    // this[dst] = this[src]
+    void move(size_t dst, size_t src)
+    {
+        x[dst] = x[src];
+        y[dst] = y[src];
+        vx[dst] = vx[src];
+        vy[dst] = vy[src];
+        ax[dst] = ax[src];
+        ay[dst] = ay[src];
+        mass[dst] = mass[src];
+        radius[dst] = radius[src];
+        id[dst] = id[src];
+        cost[dst] = cost[src];
+        color[dst] = color[src];
+    }
+
+    // Move count bodies from src down to dst <= src
+    void move_range(size_t dst, size_t src, size_t count)
+    {
+        if (dst == src || count == 0)
+            return;
+        std::copy(x.begin() + src, x.begin() + src + count, x.begin() + dst);
+        std::copy(y.begin() + src, y.begin() + src + count, y.begin() + dst);
+        std::copy(vx.begin() + src, vx.begin() + src + count, vx.begin() + dst);
+        std::copy(vy.begin() + src, vy.begin() + src + count, vy.begin() + dst);
+        std::copy(ax.begin() + src, ax.begin() + src + count, ax.begin() + dst);
+        std::copy(ay.begin() + src, ay.begin() + src + count, ay.begin() + dst);
+        std::copy(mass.begin() + src, mass.begin() + src + count, mass.begin() + dst);
+        std::copy(radius.begin() + src, radius.begin() + src + count, radius.begin() + dst);
+        std::copy(id.begin() + src, id.begin() + src + count, id.begin() + dst);
+        std::copy(cost.begin() + src, cost.begin() + src + count, cost.begin() + dst);
+        std::copy(color.begin() + src, color.begin() + src + count, color.begin() + dst);
+    }
+
+    // Drop every body with keep[i] == 0 in place, the rest keep their order.
+    // Each thread compacts its own slice, then the slices slide down in
+    // order since they may overlap.
+    void compact(const std::vector<uint8_t> &keep, std::vector<size_t> &chunk_counts)
+    {
+        const size_t n = size();
+        chunk_counts.assign(static_cast<size_t>(omp_get_max_threads()), 0);
+        int chunks = 1;
+
+#pragma omp parallel
+        {
+            const int t = omp_get_thread_num();
+            const int nt = omp_get_num_threads();
+            const auto [begin, end] = thread_range(n, t, nt);
+#pragma omp single nowait
+            chunks = nt;
+
+            size_t w = begin;
+            for (size_t i = begin; i < end; ++i)
+            {
+                if (!keep[i])
+                    continue;
+                if (w != i)
+                    move(w, i);
+                ++w;
+            }
+            chunk_counts[t] = w - begin;
+        }
+
+        size_t w = 0;
+        for (int t = 0; t < chunks; ++t)
+        {
+            move_range(w, thread_range(n, t, chunks).first, chunk_counts[t]);
+            w += chunk_counts[t];
+        }
+        resize(w);
+    }
+
+    void swap(BodySoA &other) noexcept
+    {
+        x.swap(other.x);
+        y.swap(other.y);
+        vx.swap(other.vx);
+        vy.swap(other.vy);
+        ax.swap(other.ax);
+        ay.swap(other.ay);
+        mass.swap(other.mass);
+        radius.swap(other.radius);
+        id.swap(other.id);
+        cost.swap(other.cost);
+        color.swap(other.color);
+    }
+
+    // Semi-implicit Euler step for every body, see Body::update
+    void update(float dt)
+    {
+        const size_t n = size();
+#pragma omp parallel for
+        for (size_t i = 0; i < n; ++i)
+        {
+            vx[i] += ax[i] * dt;
+            vy[i] += ay[i] * dt;
+            x[i] += vx[i] * dt;
+            y[i] += vy[i] * dt;
+            ax[i] = 0.0f;
+            ay[i] = 0.0f;
+        }
+    }
+
+    // Velocity update from the stored accelerations, which are kept
+    void kick(float h)
+    {
+        const size_t n = size();
+#pragma omp parallel for
+        for (size_t i = 0; i < n; ++i)
+        {
+            vx[i] += ax[i] * h;
+            vy[i] += ay[i] * h;
+        }
+    }
+
+    void drift(float h)
+    {
+        const size_t n = size();
+#pragma omp parallel for
+        for (size_t i = 0; i < n; ++i)
+        {
+            x[i] += vx[i] * h;
+            y[i] += vy[i] * h;
+        }
+    }
+};
+
+// Merge body j into body i in place, see merge_bodies(const Body &, const Body &)
+void merge_bodies(BodySoA &b, size_t i, size_t j)
+{
+    const float mi = b.mass[i];
+    const float mj = b.mass[j];
+    const float new_mass = mi + mj;
+
+    if (!(mi > mj))
+    {
+        b.color[i] = b.color[j];
+        b.id[i] = b.id[j];
+    }
+
+    b.x[i] = (b.x[i] * mi + b.x[j] * mj) / new_mass;
+    b.y[i] = (b.y[i] * mi + b.y[j] * mj) / new_mass;
+    b.vx[i] = (b.vx[i] * mi + b.vx[j] * mj) / new_mass;
+    b.vy[i] = (b.vy[i] * mi + b.vy[j] * mj) / new_mass;
+    b.ax[i] = 0.0f;
+    b.ay[i] = 0.0f;
+    b.radius[i] = std::cbrt(std::pow(b.radius[i], 3) + std::pow(b.radius[j], 3));
+    b.mass[i] = new_mass;
+}
+
+#endif
@@ -0,0 +1,377 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "body_soa.h"
+#include "simulation.h"
+
+// Binary checkpoint: a fixed header followed by one contiguous, 64-byte
+// aligned array per body field in BodySoA order. Files use the native
+// byte order, which the header records.
+constexpr char CHECKPOINT_MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'C', 'K', '\0'};
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+constexpr uint32_t CHECKPOINT_BYTE_ORDER = 0x01020304;
+constexpr size_t CHECKPOINT_ALIGN = 64;
+
+enum CheckpointField
+{
+    FIELD_X,
+    FIELD_Y,
+    FIELD_VX,
+    FIELD_VY,
+    FIELD_AX,
+    FIELD_AY,
+    FIELD_MASS,
+    FIELD_RADIUS,
+    FIELD_ID,
+    FIELD_COLOR,
+    FIELD_COUNT
+};
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t count;
+    int64_t frame;
+    float dt;
+    float theta;
+    float epsilon;
+    uint32_t field_count;
+    // Byte offset of each field's array from the start of the file
+    uint64_t offsets[FIELD_COUNT];
+    uint64_t file_size;
+};
+
+// Bytes per body of each field
+size_t checkpoint_field_size(int field)
+{
+    return field == FIELD_COLOR ? sizeof(glm::vec3) : sizeof(float);
+}
+
+size_t checkpoint_align(size_t offset)
+{
+    return (offset + CHECKPOINT_ALIGN - 1) / CHECKPOINT_ALIGN * CHECKPOINT_ALIGN;
+}
+
+// Header for count bodies with the layout filled in
+CheckpointHeader make_checkpoint_header(size_t count, int frame, float dt, float theta, float epsilon)
+{
+    CheckpointHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+    h.version = CHECKPOINT_VERSION;
+    h.byte_order = CHECKPOINT_BYTE_ORDER;
+    h.count = count;
+    h.frame = frame;
+    h.dt = dt;
+    h.theta = theta;
+    h.epsilon = epsilon;
+    h.field_count = FIELD_COUNT;
+
+    size_t offset = checkpoint_align(sizeof(CheckpointHeader));
+    for (int f = 0; f < FIELD_COUNT; ++f)
+    {
+        h.offsets[f] = offset;
+        offset = checkpoint_align(offset + count * checkpoint_field_size(f));
+    }
+    h.file_size = offset;
+    return h;
+}
+
+// Start of field f's array in bodies
+const void *checkpoint_field_data(const BodySoA &b, int f)
+{
+    switch (f)
+    {
+    case FIELD_X:
+        return b.x.data();
+    case FIELD_Y:
+        return b.y.data();
+    case FIELD_VX:
+        return b.vx.data();
+    case FIELD_VY:
+        return b.vy.data();
+    case FIELD_AX:
+        return b.ax.data();
+    case FIELD_AY:
+        return b.ay.data();
+    case FIELD_MASS:
+        return b.mass.data();
+    case FIELD_RADIUS:
+        return b.radius.data();
+    case FIELD_ID:
+        return b.id.data();
+    default:
+        return b.color.data();
+    }
+}
+
+void *checkpoint_field_data(BodySoA &b, int f)
+{
+    return const_cast<void *>(checkpoint_field_data(static_cast<const BodySoA &>(b), f));
+}
+
+// Read-only view of a checkpoint file through mmap. The body arrays are
+// used in place; restore() is a straight copy with no parsing.
+class MappedCheckpoint
+{
+public:
+    MappedCheckpoint() = default;
+    MappedCheckpoint(const MappedCheckpoint &) = delete;
+    MappedCheckpoint &operator=(const MappedCheckpoint &) = delete;
+
+    ~MappedCheckpoint()
+    {
+        close();
+    }
+
+    bool open(const std::string &path)
+    {
+        close();
+
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            std::cerr << "Cannot open checkpoint " << path << std::endl;
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(CheckpointHeader))
+        {
+            std::cerr << "Checkpoint " << path << " is truncated" << std::endl;
+            ::close(fd);
+            return false;
+        }
+
+        size = static_cast<size_t>(st.st_size);
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED)
+        {
+            std::cerr << "Cannot map checkpoint " << path << std::endl;
+            data = nullptr;
+            return false;
+        }
+
+        if (!valid())
+        {
+            std::cerr << "Checkpoint " << path << " has an unsupported format" << std::endl;
+            close();
+            return false;
+        }
+
+        // The arrays are read front to back exactly once
+        madvise(data, size, MADV_SEQUENTIAL);
+        madvise(data, size, MADV_WILLNEED);
+        return true;
+    }
+
+    void close()
+    {
+        if (data)
+            munmap(data, size);
+        data = nullptr;
+        size = 0;
+    }
+
+    const CheckpointHeader &header() const
+    {
+        return *static_cast<const CheckpointHeader *>(data);
+    }
+
+    // Copy the mapped arrays into bodies
+    void restore(BodySoA &bodies) const
+    {
+        const CheckpointHeader &h = header();
+        bodies.resize(h.count);
+
+#pragma omp parallel for schedule(static, 1)
+        for (int f = 0; f < FIELD_COUNT; ++f)
+        {
+            std::memcpy(checkpoint_field_data(bodies, f),
+                        static_cast<const char *>(data) + h.offsets[f],
+                        h.count * checkpoint_field_size(f));
+        }
+    }
+
+    // Header fields and the body state of sim, which must have been
+    // constructed with this checkpoint's theta and epsilon
+    void restore(Simulation &sim) const
+    {
+        restore(sim.soa);
+        sim.n = static_cast<int>(header().count);
+        sim.frame = static_cast<int>(header().frame);
+        sim.dt = header().dt;
+        sim.forces_valid = false;
+        sim.has_initial_energy = false;
+        sim.slots_dirty = true;
+        sim.qt.refittable = false;
+    }
+
+private:
+    void *data = nullptr;
+    size_t size = 0;
+
+    bool valid() const
+    {
+        const CheckpointHeader &h = header();
+        if (std::memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) != 0 ||
+            h.version != CHECKPOINT_VERSION ||
+            h.byte_order != CHECKPOINT_BYTE_ORDER ||
+            h.field_count != FIELD_COUNT)
+            return false;
+
+        const CheckpointHeader expected = make_checkpoint_header(h.count, 0, 0.0f, 0.0f, 0.0f);
+        return std::memcmp(h.offsets, expected.offsets, sizeof(h.offsets)) == 0 &&
+               h.file_size == expected.file_size && h.file_size <= size;
+    }
+};
+
+// Writes checkpoints from a background thread. save() copies the state
+// on the calling thread, which is a few memcpys, and returns while the
+// file is written to path + ".tmp", synced and renamed over path, so a
+// crash never leaves a torn checkpoint behind.
+class CheckpointWriter
+{
+public:
+    ~CheckpointWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        if (worker.joinable())
+            worker.join();
+    }
+
+    // Copy the state and return; the writer thread starts on the first
+    // save. A save requested while the previous one is still being
+    // written waits in a second buffer, and a newer save replaces it.
+    void save(const Simulation &sim, const std::string &path)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!worker.joinable())
+            worker = std::thread(&CheckpointWriter::run, this);
+        if (queued)
+            ++superseded;
+
+        queued_header = make_checkpoint_header(sim.soa.size(), sim.frame, sim.dt, sim.theta, sim.epsilon);
+        queued_state.resize(sim.soa.size());
+        for (int f = 0; f < FIELD_COUNT; ++f)
+        {
+            std::memcpy(checkpoint_field_data(queued_state, f), checkpoint_field_data(sim.soa, f),
+                        sim.soa.size() * checkpoint_field_size(f));
+        }
+        queued_target = path;
+        queued = true;
+        lock.unlock();
+        wake.notify_all();
+    }
+
+    // Block until every requested checkpoint is on disk
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&]
+                  { return !queued && !busy; });
+    }
+
+    size_t written = 0;
+    size_t failed = 0;
+    size_t superseded = 0; // Replaced by a newer save before being written
+
+private:
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool queued = false;
+    bool busy = false;
+    bool quit = false;
+    // Filled by save()
+    CheckpointHeader queued_header;
+    BodySoA queued_state;
+    std::string queued_target;
+    // Being written by the worker, swapped in from the queued buffers
+    CheckpointHeader header;
+    BodySoA pending;
+    std::string target;
+    std::thread worker;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            wake.wait(lock, [&]
+                      { return queued || quit; });
+            if (!queued)
+                return;
+
+            std::swap(header, queued_header);
+            std::swap(pending, queued_state);
+            std::swap(target, queued_target);
+            queued = false;
+            busy = true;
+
+            // save() only touches the queued buffers
+            lock.unlock();
+            const bool ok = write_file();
+            lock.lock();
+
+            ok ? ++written : ++failed;
+            busy = false;
+            wake.notify_all();
+        }
+    }
+
+    bool write_file()
+    {
+        const std::string tmp = target + ".tmp";
+        FILE *file = std::fopen(tmp.c_str(), "wb");
+        if (!file)
+        {
+            std::cerr << "Cannot write checkpoint " << tmp << std::endl;
+            return false;
+        }
+
+        static const char zeros[CHECKPOINT_ALIGN] = {};
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+        size_t offset = sizeof(header);
+        for (int f = 0; f < FIELD_COUNT && ok; ++f)
+        {
+            ok = std::fwrite(zeros, 1, header.offsets[f] - offset, file) == header.offsets[f] - offset;
+            const size_t bytes = header.count * checkpoint_field_size(f);
+            ok = ok && std::fwrite(checkpoint_field_data(pending, f), 1, bytes, file) == bytes;
+            offset = header.offsets[f] + bytes;
+        }
+        ok = ok && std::fwrite(zeros, 1, header.file_size - offset, file) == header.file_size - offset;
+        ok = ok && std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+        ok = std::fclose(file) == 0 && ok;
+
+        if (!ok || std::rename(tmp.c_str(), target.c_str()) != 0)
+        {
+            std::cerr << "Failed to write checkpoint " << target << std::endl;
+            std::remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef DIRECT_H
+#define DIRECT_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+#include "body_soa.h"
+#include "force.h"
+
+// Below this many bodies Simulation::attract() sums every pair directly
+// instead of building a tree: at that size the exact O(N^2) kernel is no
+// slower than the tree. The crossover moves with the kernel's vector
+// width; measured with sweep on one core at THETA = 1.5 for the AVX-512,
+// AVX2 and scalar builds. Rerun it to retune for other machines.
+constexpr size_t DIRECT_CROSSOVER = FORCE_SIMD_WIDTH > 1 ? 1024 : 256;
+
+// Exact O(N^2) accelerations with the same softened kernel as the tree
+// walks. Sources are processed in tiles small enough to stay in L1 while
+// a block of targets accumulates against them, with target blocks spread
+// over the threads. Each tile is summed in float and the tile sums in
+// double, so the sun's term, sorted first, does not swamp the rest.
+class DirectSummation
+{
+public:
+    static constexpr size_t TILE = 1024; // Sources per tile: 12 KB of x, y, mass
+    static constexpr size_t BLOCK = 64;  // Targets sharing each tile
+
+    InteractionList sources;
+
+    // A non-empty active mask limits the targets to the flagged bodies. Each
+    // target's cost is the n sources it summed.
+    void evaluate(BodySoA &bodies, float e_2, const std::vector<uint8_t> &active = std::vector<uint8_t>())
+    {
+        const size_t n = bodies.size();
+        const size_t padded = (n + FORCE_SIMD_WIDTH - 1) / FORCE_SIMD_WIDTH * FORCE_SIMD_WIDTH;
+        sources.x.resize(padded);
+        sources.y.resize(padded);
+        sources.mass.resize(padded);
+
+#pragma omp parallel for
+        for (size_t i = 0; i < padded; ++i)
+        {
+            const bool real = i < n;
+            sources.x[i] = real ? bodies.x[i] : 0.0f;
+            sources.y[i] = real ? bodies.y[i] : 0.0f;
+            sources.mass[i] = real ? bodies.mass[i] : 0.0f;
+        }
+
+        const bool all = active.empty();
+        const size_t blocks = (n + BLOCK - 1) / BLOCK;
+
+#pragma omp parallel for schedule(dynamic, 1)
+        for (size_t b = 0; b < blocks; ++b)
+        {
+            const size_t begin = b * BLOCK;
+            const size_t end = std::min(n, begin + BLOCK);
+            double ax[BLOCK] = {};
+            double ay[BLOCK] = {};
+
+            for (size_t t = 0; t < padded; t += TILE)
+            {
+                const size_t tile_end = std::min(padded, t + TILE);
+                for (size_t i = begin; i < end; ++i)
+                {
+                    if (!all && !active[i])
+                        continue;
+                    float tile_ax = 0.0f, tile_ay = 0.0f;
+                    accumulate(sources, t, tile_end, bodies.x[i], bodies.y[i], e_2, tile_ax, tile_ay);
+                    ax[i - begin] += tile_ax;
+                    ay[i - begin] += tile_ay;
+                }
+            }
+
+            for (size_t i = begin; i < end; ++i)
+            {
+                if (!all && !active[i])
+                    continue;
+                bodies.ax[i] = static_cast<float>(ax[i - begin]);
+                bodies.ay[i] = static_cast<float>(ay[i - begin]);
+                bodies.cost[i] = static_cast<uint32_t>(n);
+            }
+        }
+    }
+
+    // Potential of a unit mass at distance r from a unit mass under the same
+    // kernel: -1 / e (pi / 2 - atan(r / e)), or -1 / r without softening
+    static double pair_potential(double r, double e)
+    {
+        return e > 0.0 ? -(1.57079632679489662 - std::atan(r / e)) / e : -1.0 / r;
+    }
+
+    // Potential per unit mass at body i from every other body, in double
+    static double potential_at(const BodySoA &bodies, size_t i, float epsilon)
+    {
+        double phi = 0.0;
+#pragma omp parallel for reduction(+ : phi)
+        for (size_t j = 0; j < bodies.size(); ++j)
+        {
+            const double dx = static_cast<double>(bodies.x[j]) - bodies.x[i];
+            const double dy = static_cast<double>(bodies.y[j]) - bodies.y[i];
+            const double r = std::sqrt(dx * dx + dy * dy);
+            if (r > 0.0)
+                phi += bodies.mass[j] * pair_potential(r, epsilon);
+        }
+        return phi;
+    }
+
+    // Potential energy of every pair, in double
+    static double potential(const BodySoA &bodies, float epsilon)
+    {
+        const size_t n = bodies.size();
+        double total = 0.0;
+
+#pragma omp parallel for schedule(dynamic, 16) reduction(+ : total)
+        for (size_t i = 0; i < n; ++i)
+        {
+            for (size_t j = i + 1; j < n; ++j)
+            {
+                const double dx = static_cast<double>(bodies.x[j]) - bodies.x[i];
+                const double dy = static_cast<double>(bodies.y[j]) - bodies.y[i];
+                const double r = std::sqrt(dx * dx + dy * dy);
+                if (r > 0.0)
+                    total += static_cast<double>(bodies.mass[i]) * bodies.mass[j] * pair_potential(r, epsilon);
+            }
+        }
+        return total;
+    }
+};
+
+#endif
@@ -0,0 +1,708 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#include <omp.h>
+
+#ifdef NBODY_MPI
+#include <mpi.h>
+#endif
+
+#include "body.h"
+#include "body_soa.h"
+#include "quadtree.h"
+#include "morton.h"
+#include "simulation.h"
+#include "stats.h"
+
+// A transport connects the ranks of one distributed run and provides
+//   int rank() const;
+//   int size() const;
+//   void exchange(std::vector<std::vector<char>> &send, std::vector<std::vector<char>> &recv);
+// exchange() is collective over all ranks: send[r] goes to rank r and
+// recv[r] is filled with what rank r sent here. The send buffers may be
+// consumed. LoopbackTransport runs the ranks as threads of one process,
+// MpiTransport (built with -DNBODY_MPI) as MPI processes.
+
+// Mailboxes and a barrier shared by the threads of a loopback run
+class LoopbackHub
+{
+public:
+    const int ranks;
+    // mailbox[from * ranks + to]
+    std::vector<std::vector<char>> mailbox;
+
+    explicit LoopbackHub(int ranks)
+        : ranks(ranks),
+          mailbox(static_cast<size_t>(ranks) * ranks)
+    {
+    }
+
+    void barrier()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        const uint64_t gen = generation;
+        if (++arrived == ranks)
+        {
+            arrived = 0;
+            ++generation;
+            wake.notify_all();
+            return;
+        }
+        wake.wait(lock, [&]
+                  { return generation != gen; });
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable wake;
+    int arrived = 0;
+    uint64_t generation = 0;
+};
+
+class LoopbackTransport
+{
+public:
+    LoopbackTransport(LoopbackHub &hub, int rank) : hub(hub), me(rank) {}
+
+    int rank() const { return me; }
+    int size() const { return hub.ranks; }
+
+    // Buffers are swapped through the mailboxes, so their capacity is
+    // recycled instead of copied
+    void exchange(std::vector<std::vector<char>> &send, std::vector<std::vector<char>> &recv)
+    {
+        const size_t ranks = static_cast<size_t>(hub.ranks);
+        for (size_t r = 0; r < ranks; ++r)
+            hub.mailbox[me * ranks + r].swap(send[r]);
+        hub.barrier();
+
+        recv.resize(ranks);
+        for (size_t r = 0; r < ranks; ++r)
+        {
+            recv[r].clear();
+            recv[r].swap(hub.mailbox[r * ranks + me]);
+        }
+        // Nobody posts the next exchange before every mailbox is emptied
+        hub.barrier();
+    }
+
+private:
+    LoopbackHub &hub;
+    const size_t me;
+};
+
+#ifdef NBODY_MPI
+class MpiTransport
+{
+public:
+    explicit MpiTransport(MPI_Comm comm = MPI_COMM_WORLD) : comm(comm)
+    {
+        MPI_Comm_rank(comm, &me);
+        MPI_Comm_size(comm, &ranks);
+    }
+
+    int rank() const { return me; }
+    int size() const { return ranks; }
+
+    void exchange(std::vector<std::vector<char>> &send, std::vector<std::vector<char>> &recv)
+    {
+        const size_t n = static_cast<size_t>(ranks);
+        send_counts.resize(n);
+        recv_counts.resize(n);
+        send_displs.resize(n);
+        recv_displs.resize(n);
+
+        size_t total = 0;
+        for (size_t r = 0; r < n; ++r)
+        {
+            send_counts[r] = static_cast<int>(send[r].size());
+            send_displs[r] = static_cast<int>(total);
+            total += send[r].size();
+        }
+        send_flat.resize(total);
+        for (size_t r = 0; r < n; ++r)
+            std::copy(send[r].begin(), send[r].end(), send_flat.begin() + send_displs[r]);
+
+        MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1, MPI_INT, comm);
+
+        total = 0;
+        for (size_t r = 0; r < n; ++r)
+        {
+            recv_displs[r] = static_cast<int>(total);
+            total += static_cast<size_t>(recv_counts[r]);
+        }
+        recv_flat.resize(total);
+
+        MPI_Alltoallv(send_flat.data(), send_counts.data(), send_displs.data(), MPI_BYTE,
+                      recv_flat.data(), recv_counts.data(), recv_displs.data(), MPI_BYTE, comm);
+
+        recv.resize(n);
+        for (size_t r = 0; r < n; ++r)
+            recv[r].assign(recv_flat.begin() + recv_displs[r], recv_flat.begin() + recv_displs[r] + recv_counts[r]);
+    }
+
+private:
+    MPI_Comm comm;
+    int me = 0;
+    int ranks = 1;
+    std::vector<int> send_counts, recv_counts, send_displs, recv_displs;
+    std::vector<char> send_flat, recv_flat;
+};
+#endif
+
+// Messages are arrays of trivially copyable records in native byte order
+template <typename T>
+void pack(std::vector<char> &buffer, const T &value)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Records are sent as raw bytes");
+    const size_t offset = buffer.size();
+    buffer.resize(offset + sizeof(T));
+    std::memcpy(buffer.data() + offset, &value, sizeof(T));
+}
+
+template <typename T>
+size_t record_count(const std::vector<char> &buffer)
+{
+    return buffer.size() / sizeof(T);
+}
+
+template <typename T>
+T unpack(const std::vector<char> &buffer, size_t i)
+{
+    T value;
+    std::memcpy(&value, buffer.data() + i * sizeof(T), sizeof(T));
+    return value;
+}
+
+// Bounding box and body count of one rank
+struct DomainBox
+{
+    glm::vec2 lo;
+    glm::vec2 hi;
+    uint64_t count;
+    uint64_t outside; // Bodies off the curve grid, counted by decompose()
+};
+
+// A sampled curve key standing in for weight bodies
+struct KeySample
+{
+    uint32_t key;
+    float weight;
+};
+
+// A migrating body, field by field as in BodySoA
+struct BodyRecord
+{
+    float x, y, vx, vy, ax, ay, mass, radius;
+    uint32_t id, cost;
+    glm::vec3 color;
+};
+
+BodyRecord body_record(const BodySoA &bodies, size_t i)
+{
+    return BodyRecord{bodies.x[i], bodies.y[i], bodies.vx[i], bodies.vy[i], bodies.ax[i], bodies.ay[i],
+                      bodies.mass[i], bodies.radius[i], bodies.id[i], bodies.cost[i], bodies.color[i]};
+}
+
+void set_body(BodySoA &bodies, size_t i, const BodyRecord &b)
+{
+    bodies.x[i] = b.x;
+    bodies.y[i] = b.y;
+    bodies.vx[i] = b.vx;
+    bodies.vy[i] = b.vy;
+    bodies.ax[i] = b.ax;
+    bodies.ay[i] = b.ay;
+    bodies.mass[i] = b.mass;
+    bodies.radius[i] = b.radius;
+    bodies.id[i] = b.id;
+    bodies.cost[i] = b.cost;
+    bodies.color[i] = b.color;
+}
+
+// Point mass of an exported tree node or body
+struct PointMass
+{
+    float x, y, mass;
+};
+
+// One Simulation per rank on a share of the bodies. Ranks own contiguous
+// ranges of the Hilbert curve over the global bounds, chosen from a
+// weighted sample of every rank's keys so each does about as much force
+// work, by BodySoA::cost (as many bodies without Quadtree::balance_by_cost).
+// For every force evaluation a rank builds its tree, sends each other rank
+// the pruned "locally essential" part of it, the nodes that rank's domain
+// box may treat as point masses, and adds the field of the point masses it
+// receives to its own forces. Bodies that left their rank's range migrate
+// after every step and the ranges are recomputed every rebalance_interval
+// steps.
+//
+// Euler, Leapfrog and Yoshida4 work as in Simulation::step(); block time
+// steps, energy sampling, trajectories and collisions are single-process
+// only. Collisions would need a halo of bodies near the rank boundaries,
+// so they are not run at all rather than missed across ranks.
+template <typename Transport>
+class DistributedSimulation
+{
+public:
+    Transport &transport;
+    // Caller-side AoS view of this rank's bodies, refreshed by sim.sync()
+    std::vector<Body> bodies;
+    Simulation sim;
+
+    // Steps between recomputing the curve ranges (0 keeps the first ones)
+    int rebalance_interval = 10;
+    // Keys sampled per rank when choosing the ranges
+    size_t samples_per_rank = 256;
+    // Share of the bounds added around a new curve grid, and share of the
+    // bodies allowed off it before decompose() lays a new one
+    float domain_margin = 0.25f;
+    float grid_max_outside = 0.01f;
+
+    // Rank r owns keys [splitters[r - 1], splitters[r]) of a Hilbert curve
+    // over the square at domain_min with domain_inv_cell cells per unit
+    std::vector<uint32_t> splitters;
+    glm::vec2 domain_min = glm::vec2(0.0f);
+    float domain_inv_cell = 0.0f;
+
+    // Every rank's bounds at the last force evaluation
+    std::vector<DomainBox> boxes;
+
+    // Point masses received from the other ranks and the tree over them.
+    // They already passed the opening test of their own tree, and grouping
+    // them again at theta would double the approximation error, so this
+    // tree opens at remote_theta_scale * theta. Against direct summation
+    // at 100k bodies, 4 ranks, theta 0.5 and the sun excluded, halving it
+    // took the relative force error from RMS 4.2e-5, max 3.4e-4 to RMS
+    // 2.9e-5, max 1.7e-4, near the single process RMS of 4.6e-5; summing
+    // the point masses exactly was about 12x slower per step.
+    static constexpr float remote_theta_scale = 0.5f;
+    BodySoA remote;
+    Quadtree remote_tree;
+
+    size_t decompositions = 0;
+    size_t migrated = 0; // Bodies this rank sent away
+    size_t exported = 0; // Point masses this rank sent to the others
+    size_t imported = 0; // Point masses this rank received
+
+    // initial holds the bodies this rank starts with, in any split across
+    // the ranks; the first step redistributes them
+    DistributedSimulation(Transport &transport, const std::vector<Body> &initial, float dt, float theta, float epsilon)
+        : transport(transport),
+          bodies(initial),
+          sim(static_cast<int>(initial.size()), dt, bodies, theta, epsilon, false),
+          remote_tree(theta * remote_theta_scale, epsilon)
+    {
+    }
+
+    void step()
+    {
+        if (decompositions == 0)
+            decompose();
+
+        sim.begin_stats();
+
+        if (sim.reorder_interval > 0 && sim.frame % sim.reorder_interval == 0)
+        {
+            PhaseTimer timer(sim.stats, PHASE_REORDER);
+            sim.reorder();
+        }
+
+        if (sim.integrator == Integrator::Euler)
+        {
+            evaluate_forces();
+            sim.iterate();
+        }
+        else
+        {
+            // The evaluation is collective, so the ranks must agree on
+            // whether the last one can be reused
+            all_gather(static_cast<uint8_t>(sim.forces_valid), valid);
+            sim.forces_valid = std::find(valid.begin(), valid.end(), 0) == valid.end();
+
+            if (sim.integrator == Integrator::Leapfrog)
+            {
+                kick_drift_kick(sim.dt);
+            }
+            else
+            {
+                kick_drift_kick(static_cast<float>(YOSHIDA_W1 * sim.dt));
+                kick_drift_kick(static_cast<float>(YOSHIDA_W0 * sim.dt));
+                kick_drift_kick(static_cast<float>(YOSHIDA_W1 * sim.dt));
+            }
+        }
+        sim.frame += 1;
+
+        {
+            PhaseTimer timer(sim.stats, PHASE_EXCHANGE);
+            if (rebalance_interval > 0 && sim.frame % rebalance_interval == 0)
+                decompose();
+            else
+                migrate();
+        }
+
+        sim.end_stats();
+    }
+
+    // Local forces from the rank's own tree plus the field of the others'
+    // essential trees
+    void evaluate_forces()
+    {
+        sim.attract();
+        {
+            PhaseTimer timer(sim.stats, PHASE_EXCHANGE);
+            exchange_essential();
+        }
+        {
+            PhaseTimer timer(sim.stats, PHASE_FORCE);
+            add_remote_forces();
+        }
+        sim.force_evaluations += sim.soa.size();
+        sim.forces_valid = true;
+    }
+
+    // Simulation::kick_drift_kick() with the distributed force evaluation
+    void kick_drift_kick(float h)
+    {
+        if (!sim.forces_valid)
+            evaluate_forces();
+
+        {
+            PhaseTimer timer(sim.stats, PHASE_INTEGRATE);
+            sim.soa.kick(0.5f * h);
+            sim.soa.drift(h);
+        }
+        evaluate_forces();
+        PhaseTimer timer(sim.stats, PHASE_INTEGRATE);
+        sim.soa.kick(0.5f * h);
+    }
+
+    // Recompute the global curve grid and the rank ranges, then migrate
+    void decompose()
+    {
+        const float grid = domain_inv_cell > 0.0f ? MORTON_CELLS / domain_inv_cell : 0.0f;
+        const glm::vec2 top = domain_min + glm::vec2(grid);
+        uint64_t off_grid = 0;
+#pragma omp parallel for reduction(+ : off_grid)
+        for (size_t i = 0; i < sim.soa.size(); ++i)
+        {
+            const glm::vec2 pos = sim.soa.position(i);
+            off_grid += pos.x < domain_min.x || pos.y < domain_min.y || pos.x > top.x || pos.y > top.y;
+        }
+        DomainBox mine = local_box();
+        mine.outside = off_grid;
+        all_gather(mine, boxes);
+
+        glm::vec2 lo(std::numeric_limits<float>::max());
+        glm::vec2 hi(-std::numeric_limits<float>::max());
+        uint64_t total_count = 0, outside = 0;
+        for (const DomainBox &b : boxes)
+        {
+            total_count += b.count;
+            outside += b.outside;
+            if (b.count == 0)
+                continue;
+            lo = glm::min(lo, b.lo);
+            hi = glm::max(hi, b.hi);
+        }
+        if (lo.x > hi.x)
+            lo = hi = glm::vec2(0.0f);
+
+        // A new grid renumbers the whole curve and moves most bodies. Keys
+        // clamp to the edge of the grid, so bodies off it still have an
+        // owner and the grid is kept until more than grid_max_outside of
+        // them left it, or the bodies shrank to a corner of it.
+        const float extent = std::max(hi.x - lo.x, hi.y - lo.y);
+        const bool keep = grid > 0.0f && outside <= grid_max_outside * total_count &&
+                          extent * (1.0f + 2.0f * domain_margin) >= grid * 0.5f;
+        if (!keep)
+        {
+            const float padded = extent * (1.0f + domain_margin);
+            domain_min = (lo + hi) * 0.5f - glm::vec2(padded * 0.5f);
+            domain_inv_cell = padded > 0.0f ? MORTON_CELLS / padded : 0.0f;
+        }
+
+        // Evenly spaced local keys, each weighted by the work of the bodies it
+        // stands for
+        const size_t count = sim.soa.size();
+        keys.resize(count);
+        order.resize(count);
+#pragma omp parallel for
+        for (size_t i = 0; i < count; ++i)
+        {
+            keys[i] = hilbert_key(sim.soa.position(i), domain_min, domain_inv_cell);
+            order[i] = static_cast<uint32_t>(i);
+        }
+        radix_sort_pairs(keys, order, keys_tmp, order_tmp, sort_hist);
+
+        const size_t k = std::min(samples_per_rank, count);
+        send.resize(transport.size());
+        send[0].clear();
+        for (size_t j = 0; j < k; ++j)
+        {
+            double weight = 0.0;
+            for (size_t m = j * count / k; m < (j + 1) * count / k; ++m)
+                weight += static_cast<double>(sim.qt.body_cost(sim.soa, order[m]));
+            pack(send[0], KeySample{keys[(2 * j + 1) * count / (2 * k)], static_cast<float>(weight)});
+        }
+        for (size_t r = 1; r < send.size(); ++r)
+            send[r] = send[0];
+        transport.exchange(send, recv);
+
+        samples.clear();
+        double total = 0.0;
+        for (const std::vector<char> &buffer : recv)
+        {
+            for (size_t j = 0; j < record_count<KeySample>(buffer); ++j)
+            {
+                samples.push_back(unpack<KeySample>(buffer, j));
+                total += samples.back().weight;
+            }
+        }
+        std::sort(samples.begin(), samples.end(), [](const KeySample &a, const KeySample &b)
+                  { return a.key < b.key; });
+
+        // Rank r starts at the first sample past r / size of the weight
+        const int ranks = transport.size();
+        splitters.assign(ranks - 1, std::numeric_limits<uint32_t>::max());
+        double below = 0.0;
+        int r = 1;
+        for (const KeySample &s : samples)
+        {
+            while (r < ranks && below >= total * r / ranks)
+                splitters[r++ - 1] = s.key;
+            below += s.weight;
+        }
+
+        decompositions++;
+        migrate();
+    }
+
+    // Send every body outside this rank's key range to its owner
+    void migrate()
+    {
+        const size_t count = sim.soa.size();
+        const int me = transport.rank();
+        send.resize(transport.size());
+        for (std::vector<char> &buffer : send)
+            buffer.clear();
+
+        keep.resize(count);
+        size_t leaving = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const int owner = owner_of(sim.soa.position(i));
+            keep[i] = owner == me;
+            if (!keep[i])
+            {
+                pack(send[owner], body_record(sim.soa, i));
+                leaving++;
+            }
+        }
+        transport.exchange(send, recv);
+
+        size_t arriving = 0;
+        for (const std::vector<char> &buffer : recv)
+            arriving += record_count<BodyRecord>(buffer);
+        if (leaving == 0 && arriving == 0)
+            return;
+
+        sim.soa.compact(keep, sim.compact_counts);
+        size_t next = sim.soa.size();
+        sim.soa.resize(next + arriving);
+        for (const std::vector<char> &buffer : recv)
+        {
+            for (size_t j = 0; j < record_count<BodyRecord>(buffer); ++j)
+                set_body(sim.soa, next++, unpack<BodyRecord>(buffer, j));
+        }
+
+        // Forces travel with the bodies, so leapfrog state stays valid
+        migrated += leaving;
+        sim.n = static_cast<int>(sim.soa.size());
+        sim.slots_dirty = true;
+        sim.qt.refittable = false;
+    }
+
+    // Rank whose curve range holds pos
+    int owner_of(const glm::vec2 &pos) const
+    {
+        const uint32_t key = hilbert_key(pos, domain_min, domain_inv_cell);
+        return static_cast<int>(std::upper_bound(splitters.begin(), splitters.end(), key) - splitters.begin());
+    }
+
+    // Every rank's value, indexed by rank; collective
+    template <typename T>
+    void all_gather(const T &value, std::vector<T> &values)
+    {
+        send.resize(transport.size());
+        for (std::vector<char> &buffer : send)
+        {
+            buffer.clear();
+            pack(buffer, value);
+        }
+        transport.exchange(send, recv);
+
+        values.resize(recv.size());
+        for (size_t r = 0; r < recv.size(); ++r)
+            values[r] = unpack<T>(recv[r], 0);
+    }
+
+private:
+    std::vector<std::vector<char>> send, recv;
+    std::vector<uint32_t> keys, order, keys_tmp, order_tmp;
+    std::vector<size_t> sort_hist;
+    std::vector<KeySample> samples;
+    std::vector<uint8_t> keep, valid;
+    InteractionList essential;
+    std::vector<InteractionList> lists; // Per thread, for the remote group walk
+
+    DomainBox local_box() const
+    {
+        const Quad q = new_quadtree(sim.soa);
+        const glm::vec2 half(q.size * 0.5f);
+        return DomainBox{q.center - half, q.center + half, sim.soa.size(), 0};
+    }
+
+    // Send each rank the nodes of this rank's tree its domain box may treat
+    // as point masses, with the same box test as the group walk. Without a
+    // tree (direct summation below sim.direct_crossover) the bodies go as is.
+    void exchange_essential()
+    {
+        all_gather(local_box(), boxes);
+
+        const int me = transport.rank();
+        const bool tree = sim.soa.size() >= sim.direct_crossover;
+        for (int r = 0; r < transport.size(); ++r)
+        {
+            std::vector<char> &buffer = send[r];
+            buffer.clear();
+            if (r == me || boxes[r].count == 0)
+                continue;
+
+            if (tree)
+            {
+                sim.qt.interaction_list(boxes[r].lo, boxes[r].hi, essential);
+                for (size_t k = 0; k < essential.size(); ++k)
+                {
+                    if (essential.mass[k] > 0.0f)
+                        pack(buffer, PointMass{essential.x[k], essential.y[k], essential.mass[k]});
+                }
+            }
+            else
+            {
+                for (size_t i = 0; i < sim.soa.size(); ++i)
+                    pack(buffer, PointMass{sim.soa.x[i], sim.soa.y[i], sim.soa.mass[i]});
+            }
+            exported += record_count<PointMass>(buffer);
+        }
+        transport.exchange(send, recv);
+
+        size_t count = 0;
+        for (const std::vector<char> &buffer : recv)
+            count += record_count<PointMass>(buffer);
+        remote.resize(count);
+        size_t next = 0;
+        for (const std::vector<char> &buffer : recv)
+        {
+            for (size_t j = 0; j < record_count<PointMass>(buffer); ++j, ++next)
+            {
+                const PointMass p = unpack<PointMass>(buffer, j);
+                remote.x[next] = p.x;
+                remote.y[next] = p.y;
+                remote.mass[next] = p.mass;
+            }
+        }
+        imported += count;
+    }
+
+    void add_remote_forces()
+    {
+        if (remote.empty())
+            return;
+
+        // Few enough to sum exactly, as attract() does for its own bodies
+        if (remote.size() < sim.direct_crossover)
+        {
+            essential.clear();
+            for (size_t k = 0; k < remote.size(); ++k)
+                essential.push_back(remote.x[k], remote.y[k], remote.mass[k]);
+            essential.pad();
+
+            const float e_2 = sim.epsilon * sim.epsilon;
+#pragma omp parallel for
+            for (size_t i = 0; i < sim.soa.size(); ++i)
+            {
+                float ax = 0.0f;
+                float ay = 0.0f;
+                accumulate(essential, sim.soa.x[i], sim.soa.y[i], e_2, ax, ay);
+                sim.soa.ax[i] += ax;
+                sim.soa.ay[i] += ay;
+            }
+            return;
+        }
+
+        remote_tree.leaf_size = sim.qt.leaf_size;
+        remote_tree.build(remote, new_quadtree(remote));
+        remote_tree.propagate_levels();
+
+        // Walk it once per group of the local tree, whose bodies share one
+        // interaction list as in Quadtree::acc_groups(). Any grouping is
+        // correct, the boxes come from the current positions; without a
+        // local tree over these bodies each body walks on its own.
+        const Quadtree &local = sim.qt;
+        if (local.order.size() != sim.soa.size() || local.groups.empty())
+        {
+#pragma omp parallel for
+            for (size_t i = 0; i < sim.soa.size(); ++i)
+            {
+                const glm::vec2 a = remote_tree.acc(sim.soa.position(i));
+                sim.soa.ax[i] += a.x;
+                sim.soa.ay[i] += a.y;
+            }
+            return;
+        }
+
+        lists.resize(omp_get_max_threads());
+        const float e_2 = sim.epsilon * sim.epsilon;
+#pragma omp parallel
+        {
+            InteractionList &list = lists[omp_get_thread_num()];
+
+#pragma omp for schedule(dynamic, 16)
+            for (size_t g = 0; g < local.groups.size(); ++g)
+            {
+                const auto &r = local.groups[g];
+                glm::vec2 lo(std::numeric_limits<float>::max());
+                glm::vec2 hi(-std::numeric_limits<float>::max());
+                for (uint32_t k = r.begin; k < r.end; ++k)
+                {
+                    lo = glm::min(lo, sim.soa.position(local.order[k]));
+                    hi = glm::max(hi, sim.soa.position(local.order[k]));
+                }
+                if (lo.x > hi.x)
+                    continue;
+
+                remote_tree.interaction_list(lo, hi, list);
+                for (uint32_t k = r.begin; k < r.end; ++k)
+                {
+                    const uint32_t b = local.order[k];
+                    float ax = 0.0f;
+                    float ay = 0.0f;
+                    accumulate(list, sim.soa.x[b], sim.soa.y[b], e_2, ax, ay);
+                    sim.soa.ax[b] += ax;
+                    sim.soa.ay[b] += ay;
+                }
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,313 @@
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/glm.hpp>
+#include <glm/gtx/norm.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include "body.h"
+#include "simulation.h"
+#include "options.h"
+#include "ensemble.h"
+
+// Parameter sweep runner: every combination of --sizes, --x-means, --x-stds,
+// --y-means, --y-stds, --radii and --mass-suns is run --seeds times with
+// seeds --seed, --seed+1, ..., all inside one process. Means may be zero or
+// negative. Runs are spread over --workers threads with --threads-per-run
+// OpenMP threads each. Prints one line per run and the
+// aggregate throughput in runs/hour. Usage:
+//   ensemble [--sizes N,N,...] [--x-means F,...] [--x-stds F,...] [--y-means F,...]
+//            [--y-stds F,...]
+//            [--radii F,...] [--mass-suns F,...] [--preset bimodal|plummer|uniform]
+//            [--seeds K] [--seed S] [--steps S] [--dt F]
+//            [--theta F] [--epsilon F] [--collision] [--workers W]
+//            [--threads-per-run T] [--force bh|quad|fmm]
+//            [--integrator euler|leapfrog|yoshida4] [--energy K] [--leaf-size B]
+//            [--quiet]
+
+const int NUM_BODIES = 10000;
+const bool COLLISION = false;
+
+const float X_MEAN = NUM_BODIES <= 25000 ? 10.0 : 15.0;
+const float X_STD = NUM_BODIES <= 25000 ? 3.0 : 10.0;
+const float Y_MEAN = 0.0;
+const float Y_STD = NUM_BODIES <= 25000 ? 5.0 : 10.0;
+const float MASS_SUN = 10000.0;
+
+struct Options
+{
+    std::vector<int> sizes = {NUM_BODIES};
+    std::vector<float> x_means = {X_MEAN};
+    std::vector<float> x_stds = {X_STD};
+    std::vector<float> y_means = {Y_MEAN};
+    std::vector<float> y_stds = {Y_STD};
+    std::vector<float> radii = {X_MEAN + 2.0f * X_STD}; // Uniform disk radius, Plummer scale radius
+    std::vector<float> mass_suns = {MASS_SUN};
+    InitialPreset preset = InitialPreset::BimodalDisk;
+    int seeds = 4;     // Runs per parameter combination
+    uint64_t seed = 1; // Seed of the first run, the rest count up from it
+    int steps = 100;
+    float dt = 0.01f;
+    float theta = THETA;
+    float epsilon = EPSILON;
+    bool collision = COLLISION;
+    int workers = 0;
+    int threads_per_run = 1;
+    ForceMethod force = ForceMethod::BarnesHut;
+    Integrator integrator = Integrator::Euler;
+    int energy = 0;
+    int leaf_size = 0; // 0 picks FMM_LEAF_SIZE for fmm and 1 otherwise
+    bool quiet = false;
+};
+
+void usage(const char *prog)
+{
+    std::cerr << "Usage: " << prog
+              << " [--sizes N,N,...] [--x-means F,...] [--x-stds F,...] [--y-means F,...]"
+              << " [--y-stds F,...]"
+              << " [--radii F,...] [--mass-suns F,...] [--preset bimodal|plummer|uniform]"
+              << " [--seeds K] [--seed S] [--steps S] [--dt F]"
+              << " [--theta F] [--epsilon F] [--collision] [--workers W]"
+              << " [--threads-per-run T] [--force bh|quad|fmm]"
+              << " [--integrator euler|leapfrog|yoshida4] [--energy K] [--leaf-size B]"
+              << " [--quiet]" << std::endl;
+}
+
+bool parse_options(int argc, char **argv, Options &opt)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--sizes" && has_value)
+        {
+            if (!parse_list(argv[++i], opt.sizes))
+                return false;
+        }
+        else if (arg == "--x-means" && has_value)
+        {
+            if (!parse_list(argv[++i], opt.x_means, ListValues::Any))
+                return false;
+        }
+        else if (arg == "--x-stds" && has_value)
+        {
+            if (!parse_list(argv[++i], opt.x_stds))
+                return false;
+        }
+        else if (arg == "--y-means" && has_value)
+        {
+            if (!parse_list(argv[++i], opt.y_means, ListValues::Any))
+                return false;
+        }
+        else if (arg == "--y-stds" && has_value)
+        {
+            if (!parse_list(argv[++i], opt.y_stds))
+                return false;
+        }
+        else if (arg == "--radii" && has_value)
+        {
+            if (!parse_list(argv[++i], opt.radii))
+                return false;
+        }
+        else if (arg == "--mass-suns" && has_value)
+        {
+            if (!parse_list(argv[++i], opt.mass_suns))
+                return false;
+        }
+        else if (arg == "--seeds" && has_value)
+            opt.seeds = std::atoi(argv[++i]);
+        else if (arg == "--seed" && has_value)
+            opt.seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--steps" && has_value)
+            opt.steps = std::atoi(argv[++i]);
+        else if (arg == "--dt" && has_value)
+            opt.dt = std::atof(argv[++i]);
+        else if (arg == "--theta" && has_value)
+            opt.theta = std::atof(argv[++i]);
+        else if (arg == "--epsilon" && has_value)
+            opt.epsilon = std::atof(argv[++i]);
+        else if (arg == "--collision")
+            opt.collision = true;
+        else if (arg == "--workers" && has_value)
+            opt.workers = std::atoi(argv[++i]);
+        else if (arg == "--threads-per-run" && has_value)
+            opt.threads_per_run = std::atoi(argv[++i]);
+        else if (arg == "--energy" && has_value)
+            opt.energy = std::atoi(argv[++i]);
+        else if (arg == "--leaf-size" && has_value)
+            opt.leaf_size = std::atoi(argv[++i]);
+        else if (arg == "--quiet")
+            opt.quiet = true;
+        else if (arg == "--force" && has_value && std::strcmp(argv[i + 1], "bh") == 0)
+        {
+            opt.force = ForceMethod::BarnesHut;
+            ++i;
+        }
+        else if (arg == "--force" && has_value && std::strcmp(argv[i + 1], "quad") == 0)
+        {
+            opt.force = ForceMethod::Quadrupole;
+            ++i;
+        }
+        else if (arg == "--force" && has_value && std::strcmp(argv[i + 1], "fmm") == 0)
+        {
+            opt.force = ForceMethod::Multipole;
+            ++i;
+        }
+        else if (arg == "--preset" && has_value && std::strcmp(argv[i + 1], "bimodal") == 0)
+        {
+            opt.preset = InitialPreset::BimodalDisk;
+            ++i;
+        }
+        else if (arg == "--preset" && has_value && std::strcmp(argv[i + 1], "plummer") == 0)
+        {
+            opt.preset = InitialPreset::Plummer;
+            ++i;
+        }
+        else if (arg == "--preset" && has_value && std::strcmp(argv[i + 1], "uniform") == 0)
+        {
+            opt.preset = InitialPreset::UniformDisk;
+            ++i;
+        }
+        else if (arg == "--integrator" && has_value && std::strcmp(argv[i + 1], "euler") == 0)
+        {
+            opt.integrator = Integrator::Euler;
+            ++i;
+        }
+        else if (arg == "--integrator" && has_value && std::strcmp(argv[i + 1], "leapfrog") == 0)
+        {
+            opt.integrator = Integrator::Leapfrog;
+            ++i;
+        }
+        else if (arg == "--integrator" && has_value && std::strcmp(argv[i + 1], "yoshida4") == 0)
+        {
+            opt.integrator = Integrator::Yoshida4;
+            ++i;
+        }
+        else
+        {
+            std::cerr << "Unknown or incomplete option: " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (opt.seeds <= 0 || opt.seed == 0 || opt.steps <= 0 || opt.dt <= 0.0f || opt.theta < 0.0f ||
+        opt.epsilon < 0.0f || opt.workers < 0 || opt.threads_per_run <= 0 || opt.energy < 0 ||
+        opt.leaf_size < 0)
+    {
+        std::cerr << "Invalid option value" << std::endl;
+        return false;
+    }
+    if (opt.leaf_size == 0)
+        opt.leaf_size = opt.force == ForceMethod::Multipole ? static_cast<int>(FMM_LEAF_SIZE) : 1;
+    return true;
+}
+
+// Replace each run by one copy per value, set by set(run, value)
+template <typename T, typename Set>
+void expand(std::vector<EnsembleRun> &runs, const std::vector<T> &values, Set set)
+{
+    std::vector<EnsembleRun> grid;
+    grid.reserve(runs.size() * values.size());
+    for (const EnsembleRun &run : runs)
+        for (const T v : values)
+        {
+            grid.push_back(run);
+            set(grid.back(), v);
+        }
+    runs.swap(grid);
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    if (!parse_options(argc, argv, opt))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    Ensemble ensemble;
+    ensemble.theta = opt.theta;
+    ensemble.epsilon = opt.epsilon;
+    ensemble.collision = opt.collision;
+    ensemble.workers = opt.workers;
+    ensemble.threads_per_run = opt.threads_per_run;
+
+    // Every combination, the first parameter varying slowest, then the seeds
+    EnsembleRun base;
+    base.steps = opt.steps;
+    base.dt = opt.dt;
+    base.initial.preset = opt.preset;
+    ensemble.runs.assign(1, base);
+    expand(ensemble.runs, opt.sizes, [](EnsembleRun &r, int v)
+           { r.bodies = v; });
+    expand(ensemble.runs, opt.x_means, [](EnsembleRun &r, float v)
+           { r.initial.x_mean = v; });
+    expand(ensemble.runs, opt.x_stds, [](EnsembleRun &r, float v)
+           { r.initial.x_std = v; });
+    expand(ensemble.runs, opt.y_means, [](EnsembleRun &r, float v)
+           { r.initial.y_mean = v; });
+    expand(ensemble.runs, opt.y_stds, [](EnsembleRun &r, float v)
+           { r.initial.y_std = v; });
+    expand(ensemble.runs, opt.radii, [](EnsembleRun &r, float v)
+           { r.initial.radius = v; });
+    expand(ensemble.runs, opt.mass_suns, [](EnsembleRun &r, float v)
+           { r.initial.mass_sun = v; });
+    expand(ensemble.runs, std::vector<int>(opt.seeds), [](EnsembleRun &, int) {});
+    for (size_t i = 0; i < ensemble.runs.size(); ++i)
+        ensemble.runs[i].initial.seed = opt.seed + i;
+
+    std::cout << "runs=" << ensemble.runs.size()
+              << " steps=" << opt.steps
+              << " dt=" << opt.dt
+              << " preset=" << (opt.preset == InitialPreset::BimodalDisk ? "bimodal" : opt.preset == InitialPreset::Plummer ? "plummer" : "uniform")
+              << " theta=" << opt.theta
+              << " epsilon=" << opt.epsilon
+              << " collision=" << (opt.collision ? "on" : "off")
+              << " workers=" << (opt.workers > 0 ? opt.workers : std::max(1, omp_get_max_threads() / opt.threads_per_run))
+              << " threads_per_run=" << opt.threads_per_run
+              << " simd=" << FORCE_SIMD_WIDTH << std::endl;
+
+    std::mutex out;
+    ensemble.run([&](Simulation &sim)
+                 {
+                     sim.force_method = opt.force;
+                     sim.integrator = opt.integrator;
+                     sim.energy_interval = opt.energy;
+                     sim.qt.leaf_size = static_cast<size_t>(opt.leaf_size); },
+                 [&](size_t i, const EnsembleResult &result)
+                 {
+                     if (opt.quiet)
+                         return;
+                     const EnsembleRun &run = ensemble.runs[i];
+                     std::lock_guard<std::mutex> lock(out);
+                     std::cout << "run=" << i
+                               << " bodies=" << run.bodies
+                               << " x_mean=" << run.initial.x_mean
+                               << " x_std=" << run.initial.x_std
+                               << " y_mean=" << run.initial.y_mean
+                               << " y_std=" << run.initial.y_std
+                               << " radius=" << run.initial.radius
+                               << " mass_sun=" << run.initial.mass_sun
+                               << " seed=" << run.initial.seed
+                               << " seconds=" << result.seconds
+                               << " final_bodies=" << result.final_bodies
+                               << " force_evals=" << result.force_evaluations;
+                     if (opt.energy > 0)
+                         std::cout << " energy_drift=" << result.energy_drift;
+                     std::cout << " worker=" << result.worker << std::endl; });
+
+    std::cout << "elapsed=" << ensemble.seconds << "s"
+              << " runs/hour=" << ensemble.runs_per_hour()
+              << " body-updates/sec=" << (ensemble.seconds > 0.0 ? ensemble.body_updates / ensemble.seconds : 0.0)
+              << std::endl;
+
+    return 0;
+}
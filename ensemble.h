@@ -0,0 +1,145 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <vector>
+#include <optional>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+#include "body.h"
+#include "simulation.h"
+
+// One independent run of an ensemble
+struct EnsembleRun
+{
+    int bodies = 10000;
+    int steps = 100;
+    float dt = 0.01f;
+    InitialConditions initial;
+};
+
+struct EnsembleResult
+{
+    double seconds = 0.0;
+    size_t final_bodies = 0;
+    size_t force_evaluations = 0;
+    double energy_drift = 0.0; // Final value, with Simulation::energy_interval
+    int worker = -1;
+};
+
+// Runs many independent simulations at once on a pool of worker threads.
+// Each worker owns one Simulation and restarts it for every run it takes,
+// so runs share nothing but that worker's scratch buffers. Small runs go
+// one per core; threads_per_run > 1 gives each worker an OpenMP team of
+// that size for larger runs. Workers take the most expensive runs first
+// so the last ones to finish are short.
+class Ensemble
+{
+public:
+    // Shared by every run: the Quadtree fixes theta and epsilon
+    float theta = THETA;
+    float epsilon = EPSILON;
+    bool collision = false;
+
+    int workers = 0; // 0 fills the cores with threads_per_run each
+    int threads_per_run = 1;
+
+    std::vector<EnsembleRun> runs;
+    std::vector<EnsembleResult> results;
+    double seconds = 0.0;
+    double body_updates = 0.0;
+
+    // configure(sim) sets up each worker's Simulation before its first run;
+    // done(index, result) is called from the worker as each run finishes
+    template <typename Configure, typename Done>
+    void run(Configure configure, Done done)
+    {
+        const int pool = workers > 0 ? workers : std::max(1, omp_get_max_threads() / std::max(1, threads_per_run));
+        results.assign(runs.size(), EnsembleResult());
+        updates.assign(pool, 0.0);
+
+        // Largest first: tree steps cost about N log N
+        order.resize(runs.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                         { return cost(runs[a]) > cost(runs[b]); });
+        next = 0;
+
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int w = 0; w < pool; ++w)
+            threads.emplace_back([&, w]
+                                 { work(w, configure, done); });
+        for (std::thread &t : threads)
+            t.join();
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        body_updates = 0.0;
+        for (const double u : updates)
+            body_updates += u;
+    }
+
+    double runs_per_hour() const
+    {
+        return seconds > 0.0 ? static_cast<double>(runs.size()) * 3600.0 / seconds : 0.0;
+    }
+
+private:
+    std::vector<size_t> order;
+    std::atomic<size_t> next{0};
+    std::vector<double> updates; // Per worker
+
+    template <typename Configure, typename Done>
+    void work(int w, Configure &configure, Done &done)
+    {
+        omp_set_num_threads(std::max(1, threads_per_run));
+        std::vector<Body> bodies;
+        std::optional<Simulation> sim;
+
+        for (size_t k = next++; k < order.size(); k = next++)
+        {
+            const size_t i = order[k];
+            const EnsembleRun &r = runs[i];
+            const auto start = std::chrono::steady_clock::now();
+
+            bodies.clear();
+            initializeBodies(bodies, r.bodies, r.initial);
+            if (!sim)
+            {
+                sim.emplace(static_cast<int>(bodies.size()), r.dt, bodies, theta, epsilon, collision);
+                configure(*sim);
+            }
+            else
+            {
+                sim->restart();
+            }
+            sim->dt = r.dt;
+
+            for (int s = 0; s < r.steps; ++s)
+            {
+                updates[w] += static_cast<double>(sim->soa.size());
+                sim->step();
+            }
+
+            EnsembleResult &result = results[i];
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            result.final_bodies = sim->soa.size();
+            result.force_evaluations = sim->force_evaluations;
+            result.energy_drift = sim->energy_drift;
+            result.worker = w;
+            done(i, result);
+        }
+    }
+
+    static double cost(const EnsembleRun &r)
+    {
+        const double n = std::max(2, r.bodies);
+        return n * std::log2(n) * r.steps;
+    }
+};
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef FMM_H
+#define FMM_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <omp.h>
+#include "body_soa.h"
+#include "quadtree.h"
+#include "multipole.h"
+
+// Dual-tree fast multipole evaluation over a tree from Quadtree::build()
+// with moments from propagate_moments(). Well-separated cell pairs add the
+// source's monopole and quadrupole into the target's local expansion,
+// remaining leaf pairs interact directly (body by body between leaf
+// buckets when Quadtree::leaf_size > 1), then the expansions are pushed
+// down the tree and evaluated at each body. A non-empty active mask limits
+// the targets to cells holding a flagged body.
+//
+// A leaf with a body of at least heavy_fraction of the total mass, the
+// sun, is never folded into an expansion: cells around it are opened down
+// to it, and it is summed exactly into every target leaf. Its field
+// dominates every body's force, and a second-order expansion of it would
+// dominate the error.
+//
+// Leaf buckets carry the near field: with one body per leaf every near
+// pair goes through add_source(), with buckets through the SIMD kernel.
+// At FMM_LEAF_SIZE and theta 1.0 the engine beats the monopole group walk
+// at theta 0.5 on accuracy at a third of the cost (100k bodies, sweep).
+constexpr size_t FMM_LEAF_SIZE = 16;
+
+class FastMultipole
+{
+public:
+    // Subtrees rooted at this depth are the units of parallel work
+    int split_depth = 4;
+    float heavy_fraction = 0.01f;
+    std::vector<LocalExpansion> locals;
+    std::vector<size_t> targets;
+    // Cells with an active body below them, empty when every body is active
+    std::vector<uint8_t> wanted;
+    // Cells with a heavy leaf below them
+    std::vector<uint8_t> heavy;
+    // Accelerations from neighbouring leaf buckets, per body
+    std::vector<float> near_ax, near_ay;
+
+    void evaluate(const Quadtree &qt, BodySoA &bodies, const std::vector<uint8_t> &active = std::vector<uint8_t>())
+    {
+        locals.assign(qt.nodes.size(), LocalExpansion());
+        if (qt.bucketed())
+        {
+            near_ax.assign(bodies.size(), 0.0f);
+            near_ay.assign(bodies.size(), 0.0f);
+        }
+        mark_wanted(qt, active);
+        mark_heavy(qt);
+        targets.clear();
+        collect_targets(qt, Quadtree::ROOT, 0);
+
+        // Each target subtree only writes its own expansions
+#pragma omp parallel for schedule(dynamic, 1)
+        for (size_t i = 0; i < targets.size(); ++i)
+        {
+            interact(qt, targets[i], Quadtree::ROOT);
+        }
+
+        // Downward pass, parents before children
+        for (size_t l = 0; l + 1 < qt.levels.size(); ++l)
+        {
+#pragma omp parallel for
+            for (size_t k = qt.levels[l]; k < qt.levels[l + 1]; ++k)
+            {
+                const size_t node = qt.parents[k];
+                const size_t children = qt.nodes[node].children;
+                for (size_t j = 0; j < 4; ++j)
+                {
+                    const Node &child = qt.nodes[children + j];
+                    if (!child.is_empty() && is_wanted(children + j))
+                        locals[node].translate_into(child.pos - qt.nodes[node].pos, locals[children + j]);
+                }
+            }
+        }
+
+#pragma omp parallel for
+        for (size_t i = 0; i < bodies.size(); ++i)
+        {
+            if (!active.empty() && !active[i])
+                continue;
+            const size_t leaf = qt.leaf_of[i];
+            glm::vec2 a = locals[leaf].evaluate(bodies.position(i) - qt.nodes[leaf].pos);
+            if (qt.bucketed())
+                a += glm::vec2(near_ax[i], near_ay[i]);
+            bodies.ax[i] = a.x;
+            bodies.ay[i] = a.y;
+        }
+    }
+
+private:
+    bool is_wanted(size_t node) const
+    {
+        return wanted.empty() || wanted[node];
+    }
+
+    void mark_wanted(const Quadtree &qt, const std::vector<uint8_t> &active)
+    {
+        wanted.clear();
+        if (active.empty())
+            return;
+
+        wanted.assign(qt.nodes.size(), 0);
+        for (size_t i = 0; i < active.size(); ++i)
+        {
+            if (!active[i])
+                continue;
+            // Stop at the first ancestor another body already marked
+            for (size_t node = qt.leaf_of[i]; !wanted[node]; node = qt.parent_of[node])
+            {
+                wanted[node] = 1;
+                if (node == Quadtree::ROOT)
+                    break;
+            }
+        }
+    }
+
+    void mark_heavy(const Quadtree &qt)
+    {
+        const float threshold = heavy_fraction * qt.nodes[Quadtree::ROOT].mass;
+        heavy.resize(qt.nodes.size());
+
+#pragma omp parallel for
+        for (size_t node = 0; node < qt.nodes.size(); ++node)
+        {
+            const Node &n = qt.nodes[node];
+            float largest = n.mass;
+            if (n.count > 1)
+            {
+                largest = 0.0f;
+                for (uint32_t k = n.first; k < n.first + n.count; ++k)
+                    largest = std::max(largest, qt.buckets.mass[k]);
+            }
+            heavy[node] = n.is_leaf() && largest >= threshold;
+        }
+
+        for (size_t l = qt.levels.size(); l-- > 1;)
+        {
+#pragma omp parallel for
+            for (size_t k = qt.levels[l - 1]; k < qt.levels[l]; ++k)
+            {
+                const size_t node = qt.parents[k];
+                const size_t c = qt.nodes[node].children;
+                heavy[node] = heavy[c] || heavy[c + 1] || heavy[c + 2] || heavy[c + 3];
+            }
+        }
+    }
+
+    void collect_targets(const Quadtree &qt, size_t node, int depth)
+    {
+        const Node &n = qt.nodes[node];
+        if (n.is_empty() || !is_wanted(node))
+            return;
+
+        if (n.is_leaf() || depth == split_depth)
+        {
+            targets.push_back(node);
+            return;
+        }
+
+        for (size_t j = 0; j < 4; ++j)
+            collect_targets(qt, n.children + j, depth + 1);
+    }
+
+    // Accumulate the field of source cell b into target cell a
+    void interact(const Quadtree &qt, size_t a, size_t b)
+    {
+        const Node &na = qt.nodes[a];
+        const Node &nb = qt.nodes[b];
+        if (na.is_empty() || nb.is_empty() || !is_wanted(a))
+            return;
+
+        const glm::vec2 d = nb.pos - na.pos;
+        const float reach = na.size + nb.size;
+        const bool separated = reach * reach < glm::dot(d, d) * qt.t_2 && !heavy[b];
+
+        if (separated || (na.is_leaf() && nb.is_leaf()))
+        {
+            if ((!separated || heavy[b]) && qt.bucketed())
+                near_field(qt, a, b);
+            else if (a != b)
+                locals[a].add_source(d, nb.mass, qt.moments[b], qt.e_2);
+            return;
+        }
+
+        // Split the larger cell, or the only one that can be split. A heavy
+        // source is opened down to its leaf first.
+        if (nb.is_leaf() || (na.is_branch() && na.size >= nb.size && !heavy[b]))
+        {
+            for (size_t j = 0; j < 4; ++j)
+                interact(qt, na.children + j, b);
+        }
+        else
+        {
+            for (size_t j = 0; j < 4; ++j)
+                interact(qt, a, nb.children + j);
+        }
+    }
+
+    // Every body in leaf a against every body in leaf b, a itself included
+    void near_field(const Quadtree &qt, size_t a, size_t b)
+    {
+        const Node &na = qt.nodes[a];
+        const Node &nb = qt.nodes[b];
+        const size_t end = nb.first + Quadtree::padded(nb.count);
+
+        for (uint32_t k = na.first; k < na.first + na.count; ++k)
+        {
+            const uint32_t i = qt.bucket_body[k];
+            accumulate(qt.buckets, nb.first, end, qt.buckets.x[k], qt.buckets.y[k], qt.e_2, near_ax[i], near_ay[i]);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef FORCE_H
+#define FORCE_H
+
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Force kernels that evaluate a shared interaction list against the bodies
+// of one group. The vector width follows the compile flags: AVX-512 with
+// -mavx512f, AVX2 with -mavx2, otherwise the scalar fallback.
+#if defined(__AVX512F__)
+constexpr size_t FORCE_SIMD_WIDTH = 16;
+#elif defined(__AVX2__)
+constexpr size_t FORCE_SIMD_WIDTH = 8;
+#else
+constexpr size_t FORCE_SIMD_WIDTH = 1;
+#endif
+
+// Point masses (tree nodes or bodies) a group interacts with, padded with zero-mass
+// entries to a multiple of FORCE_SIMD_WIDTH
+class InteractionList
+{
+public:
+    std::vector<float> x, y, mass;
+
+    size_t size() const noexcept { return x.size(); }
+
+    void clear()
+    {
+        x.clear();
+        y.clear();
+        mass.clear();
+    }
+
+    void push_back(float px, float py, float m)
+    {
+        x.push_back(px);
+        y.push_back(py);
+        mass.push_back(m);
+    }
+
+    // Entries [begin, end) of another list
+    void append(const InteractionList &from, size_t begin, size_t end)
+    {
+        x.insert(x.end(), from.x.begin() + begin, from.x.begin() + end);
+        y.insert(y.end(), from.y.begin() + begin, from.y.begin() + end);
+        mass.insert(mass.end(), from.mass.begin() + begin, from.mass.begin() + end);
+    }
+
+    void pad()
+    {
+        while (x.size() % FORCE_SIMD_WIDTH != 0)
+            push_back(0.0f, 0.0f, 0.0f);
+    }
+};
+
+// Softened acceleration on (px, py) from entries [begin, end) of the list,
+// same formula as Quadtree::acc: d * m / ((|d|^2 + e^2) |d|), zero at
+// |d| = 0. The vector kernels need begin and end at multiples of
+// FORCE_SIMD_WIDTH.
+void accumulate_scalar(const InteractionList &list, size_t begin, size_t end, float px, float py, float e_2, float &ax, float &ay)
+{
+    for (size_t k = begin; k < end; ++k)
+    {
+        const float dx = list.x[k] - px;
+        const float dy = list.y[k] - py;
+        const float d_sq = dx * dx + dy * dy;
+        if (d_sq > 0.0f)
+        {
+            const float f = std::min(list.mass[k] / ((d_sq + e_2) * std::sqrt(d_sq)), std::numeric_limits<float>::max());
+            ax += dx * f;
+            ay += dy * f;
+        }
+    }
+}
+
+#if defined(__AVX512F__)
+void accumulate(const InteractionList &list, size_t begin, size_t end, float px, float py, float e_2, float &ax, float &ay)
+{
+    const __m512 vpx = _mm512_set1_ps(px);
+    const __m512 vpy = _mm512_set1_ps(py);
+    const __m512 ve_2 = _mm512_set1_ps(e_2);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 three_halves = _mm512_set1_ps(1.5f);
+    const __m512 fmax = _mm512_set1_ps(std::numeric_limits<float>::max());
+    __m512 vax = _mm512_setzero_ps();
+    __m512 vay = _mm512_setzero_ps();
+
+    for (size_t k = begin; k < end; k += 16)
+    {
+        const __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(&list.x[k]), vpx);
+        const __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(&list.y[k]), vpy);
+        const __m512 d_sq = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+        const __mmask16 nonzero = _mm512_cmp_ps_mask(d_sq, _mm512_setzero_ps(), _CMP_GT_OQ);
+
+        // rsqrt estimate plus one Newton step: y' = y (1.5 - 0.5 x y^2)
+        __m512 inv_d = _mm512_rsqrt14_ps(d_sq);
+        inv_d = _mm512_mul_ps(inv_d, _mm512_fnmadd_ps(_mm512_mul_ps(half, d_sq), _mm512_mul_ps(inv_d, inv_d), three_halves));
+
+        __m512 f = _mm512_div_ps(_mm512_mul_ps(_mm512_loadu_ps(&list.mass[k]), inv_d), _mm512_add_ps(d_sq, ve_2));
+        f = _mm512_maskz_min_ps(nonzero, f, fmax);
+
+        vax = _mm512_fmadd_ps(dx, f, vax);
+        vay = _mm512_fmadd_ps(dy, f, vay);
+    }
+
+    ax += _mm512_reduce_add_ps(vax);
+    ay += _mm512_reduce_add_ps(vay);
+}
+#elif defined(__AVX2__)
+float horizontal_sum(__m256 v)
+{
+    const __m128 lo = _mm256_castps256_ps128(v);
+    const __m128 hi = _mm256_extractf128_ps(v, 1);
+    __m128 s = _mm_add_ps(lo, hi);
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+void accumulate(const InteractionList &list, size_t begin, size_t end, float px, float py, float e_2, float &ax, float &ay)
+{
+    const __m256 vpx = _mm256_set1_ps(px);
+    const __m256 vpy = _mm256_set1_ps(py);
+    const __m256 ve_2 = _mm256_set1_ps(e_2);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 three_halves = _mm256_set1_ps(1.5f);
+    const __m256 fmax = _mm256_set1_ps(std::numeric_limits<float>::max());
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 vax = zero;
+    __m256 vay = zero;
+
+    for (size_t k = begin; k < end; k += 8)
+    {
+        const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&list.x[k]), vpx);
+        const __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&list.y[k]), vpy);
+        const __m256 d_sq = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        const __m256 nonzero = _mm256_cmp_ps(d_sq, zero, _CMP_GT_OQ);
+
+        // rsqrt estimate plus one Newton step: y' = y (1.5 - 0.5 x y^2)
+        __m256 inv_d = _mm256_rsqrt_ps(d_sq);
+        inv_d = _mm256_mul_ps(inv_d, _mm256_sub_ps(three_halves, _mm256_mul_ps(_mm256_mul_ps(half, d_sq), _mm256_mul_ps(inv_d, inv_d))));
+
+        __m256 f = _mm256_div_ps(_mm256_mul_ps(_mm256_loadu_ps(&list.mass[k]), inv_d), _mm256_add_ps(d_sq, ve_2));
+        f = _mm256_and_ps(_mm256_min_ps(f, fmax), nonzero);
+
+        vax = _mm256_add_ps(vax, _mm256_mul_ps(dx, f));
+        vay = _mm256_add_ps(vay, _mm256_mul_ps(dy, f));
+    }
+
+    ax += horizontal_sum(vax);
+    ay += horizontal_sum(vay);
+}
+#else
+void accumulate(const InteractionList &list, size_t begin, size_t end, float px, float py, float e_2, float &ax, float &ay)
+{
+    accumulate_scalar(list, begin, end, px, py, e_2, ax, ay);
+}
+#endif
+
+// The whole list
+void accumulate(const InteractionList &list, float px, float py, float e_2, float &ax, float &ay)
+{
+    accumulate(list, 0, list.size(), px, py, e_2, ax, ay);
+}
+
+#endif
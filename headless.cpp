@@ -0,0 +1,621 @@
+#define GLM_ENABLE_EXPERIMENTAL
+
+// Count heap allocations per step for --stats. Sanitizers bring their own
+// operator new, so their builds go without.
+#if !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+#define NBODY_COUNT_ALLOCATIONS 1
+#endif
+
+#include <glm/glm.hpp>
+#include <glm/gtx/norm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+
+#include <omp.h>
+
+#include "body.h"
+#include "simulation.h"
+#include "checkpoint.h"
+#include "distributed.h"
+
+#if NBODY_COUNT_ALLOCATIONS
+thread_local uint64_t heap_allocations = 0;
+
+// Replace the global allocation functions to count calls per thread, with
+// the matching deallocation functions on malloc and free
+void *operator new(size_t size)
+{
+    ++heap_allocations;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size, std::align_val_t align)
+{
+    ++heap_allocations;
+    const size_t a = static_cast<size_t>(align);
+    if (void *p = std::aligned_alloc(a, (std::max<size_t>(size, 1) + a - 1) / a * a))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+#endif
+
+// Headless batch driver: runs the simulation without a window as fast as
+// possible and reports throughput. Usage:
+//   headless [--bodies N] [--dt F] [--steps S] [--theta F] [--epsilon F]
+//            [--collision | --no-collision] [--threads T] [--serial-build]
+//            [--reorder K] [--curve morton|hilbert] [--scalar-walk]
+//            [--force bh|quad|fmm] [--incremental] [--block-levels L]
+//            [--timestep-accuracy F] [--integrator euler|leapfrog|yoshida4]
+//            [--energy K] [--grid-collisions] [--checkpoint K]
+//            [--checkpoint-path FILE] [--restart FILE] [--trajectory K]
+//            [--trajectory-path FILE] [--trajectory-bits B] [--stats]
+//            [--stats-path FILE.json|FILE.csv] [--stats-interval K]
+//            [--direct-crossover N] [--ranks R | --mpi] [--rebalance K]
+//            [--leaf-size B] [--no-balance] [--preset bimodal|plummer|uniform]
+//            [--radius F] [--seed S]
+//
+// --ranks runs R domain-decomposed ranks as threads of this process; --mpi
+// runs one rank per MPI process (build with mpicxx -DNBODY_MPI, launch with
+// mpirun). Rank 0 reports the totals.
+
+const int NUM_BODIES = 100000;
+const float DT = 0.01;
+const int NUM_STEPS = 100;
+const bool COLLISION = false;
+
+const float X_MEAN = NUM_BODIES <= 25000 ? 10.0 : 15.0;
+const float X_STD = NUM_BODIES <= 25000 ? 3.0 : 10.0;
+const float Y_MEAN = 0.0;
+const float Y_STD = NUM_BODIES <= 25000 ? 5.0 : 10.0;
+const float MASS_SUN = 10000.0;
+
+struct Options
+{
+    int bodies = NUM_BODIES;
+    float dt = DT;
+    int steps = NUM_STEPS;
+    float theta = THETA;
+    float epsilon = EPSILON;
+    bool collision = COLLISION;
+    int threads = 0; // 0 keeps the OpenMP default
+    bool serial_build = false;
+    int reorder = 0; // Space-filling-curve reorder interval, 0 disables
+    CurveOrder curve = CurveOrder::Hilbert;
+    bool scalar_walk = false;
+    ForceMethod force = ForceMethod::BarnesHut;
+    bool incremental = false;
+    int block_levels = 0; // Block time-step levels below dt, 0 disables
+    float timestep_accuracy = 0.25f;
+    Integrator integrator = Integrator::Euler;
+    int energy = 0; // Energy drift sampling interval, 0 disables
+    bool grid_collisions = false;
+    int checkpoint = 0; // Checkpoint interval in steps, 0 disables
+    std::string checkpoint_path = "checkpoint.nbody";
+    std::string restart; // Checkpoint to resume from instead of new bodies
+    int trajectory = 0;  // Trajectory recording interval in steps, 0 disables
+    std::string trajectory_path = "trajectory.nbt";
+    int trajectory_bits = 16;
+    bool stats = false;
+    std::string stats_path; // .json or .csv, written every stats_interval steps
+    int stats_interval = 100;
+    int direct_crossover = static_cast<int>(DIRECT_CROSSOVER); // Direct summation below this many bodies
+    int ranks = 0; // Loopback ranks, 0 runs a single Simulation
+    bool mpi = false;
+    int rebalance = 10; // Steps between domain decompositions
+    int leaf_size = 0;  // Bodies per tree leaf bucket, 0 picks FMM_LEAF_SIZE for fmm and 1 otherwise
+    bool balance = true; // Split parallel loops by last step's per-body cost
+    InitialPreset preset = InitialPreset::BimodalDisk;
+    float radius = X_MEAN + 2.0f * X_STD; // Uniform disk radius, Plummer scale radius
+    uint64_t seed = 0;                    // Initial conditions seed, 0 picks one
+};
+
+void usage(const char *prog)
+{
+    std::cerr << "Usage: " << prog
+              << " [--bodies N] [--dt F] [--steps S] [--theta F] [--epsilon F]"
+              << " [--collision | --no-collision] [--threads T] [--serial-build]"
+              << " [--reorder K] [--curve morton|hilbert] [--scalar-walk]"
+              << " [--force bh|quad|fmm] [--incremental] [--block-levels L]"
+              << " [--timestep-accuracy F] [--integrator euler|leapfrog|yoshida4]"
+              << " [--energy K] [--grid-collisions] [--checkpoint K]"
+              << " [--checkpoint-path FILE] [--restart FILE] [--trajectory K]"
+              << " [--trajectory-path FILE] [--trajectory-bits B] [--stats]"
+              << " [--stats-path FILE.json|FILE.csv] [--stats-interval K]"
+              << " [--direct-crossover N] [--ranks R | --mpi] [--rebalance K]"
+              << " [--leaf-size B] [--no-balance] [--preset bimodal|plummer|uniform]"
+              << " [--radius F] [--seed S]" << std::endl;
+}
+
+bool parse_options(int argc, char **argv, Options &opt)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+
+        if (arg == "--collision")
+            opt.collision = true;
+        else if (arg == "--no-collision")
+            opt.collision = false;
+        else if (arg == "--serial-build")
+            opt.serial_build = true;
+        else if (arg == "--scalar-walk")
+            opt.scalar_walk = true;
+        else if (arg == "--grid-collisions")
+            opt.grid_collisions = true;
+        else if (arg == "--stats")
+            opt.stats = true;
+        else if (arg == "--incremental")
+            opt.incremental = true;
+        else if (arg == "--no-balance")
+            opt.balance = false;
+        else if (arg == "--mpi")
+            opt.mpi = true;
+        else if (arg == "--bodies" && has_value)
+            opt.bodies = std::atoi(argv[++i]);
+        else if (arg == "--dt" && has_value)
+            opt.dt = std::atof(argv[++i]);
+        else if (arg == "--steps" && has_value)
+            opt.steps = std::atoi(argv[++i]);
+        else if (arg == "--theta" && has_value)
+            opt.theta = std::atof(argv[++i]);
+        else if (arg == "--epsilon" && has_value)
+            opt.epsilon = std::atof(argv[++i]);
+        else if (arg == "--threads" && has_value)
+            opt.threads = std::atoi(argv[++i]);
+        else if (arg == "--block-levels" && has_value)
+            opt.block_levels = std::atoi(argv[++i]);
+        else if (arg == "--timestep-accuracy" && has_value)
+            opt.timestep_accuracy = std::atof(argv[++i]);
+        else if (arg == "--checkpoint" && has_value)
+            opt.checkpoint = std::atoi(argv[++i]);
+        else if (arg == "--checkpoint-path" && has_value)
+            opt.checkpoint_path = argv[++i];
+        else if (arg == "--restart" && has_value)
+            opt.restart = argv[++i];
+        else if (arg == "--trajectory" && has_value)
+            opt.trajectory = std::atoi(argv[++i]);
+        else if (arg == "--trajectory-path" && has_value)
+            opt.trajectory_path = argv[++i];
+        else if (arg == "--trajectory-bits" && has_value)
+            opt.trajectory_bits = std::atoi(argv[++i]);
+        else if (arg == "--stats-path" && has_value)
+        {
+            opt.stats = true;
+            opt.stats_path = argv[++i];
+        }
+        else if (arg == "--direct-crossover" && has_value)
+            opt.direct_crossover = std::atoi(argv[++i]);
+        else if (arg == "--ranks" && has_value)
+            opt.ranks = std::atoi(argv[++i]);
+        else if (arg == "--rebalance" && has_value)
+            opt.rebalance = std::atoi(argv[++i]);
+        else if (arg == "--leaf-size" && has_value)
+            opt.leaf_size = std::atoi(argv[++i]);
+        else if (arg == "--radius" && has_value)
+            opt.radius = std::atof(argv[++i]);
+        else if (arg == "--seed" && has_value)
+            opt.seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--stats-interval" && has_value)
+            opt.stats_interval = std::atoi(argv[++i]);
+        else if (arg == "--energy" && has_value)
+            opt.energy = std::atoi(argv[++i]);
+        else if (arg == "--reorder" && has_value)
+            opt.reorder = std::atoi(argv[++i]);
+        else if (arg == "--force" && has_value && std::strcmp(argv[i + 1], "bh") == 0)
+        {
+            opt.force = ForceMethod::BarnesHut;
+            ++i;
+        }
+        else if (arg == "--force" && has_value && std::strcmp(argv[i + 1], "quad") == 0)
+        {
+            opt.force = ForceMethod::Quadrupole;
+            ++i;
+        }
+        else if (arg == "--force" && has_value && std::strcmp(argv[i + 1], "fmm") == 0)
+        {
+            opt.force = ForceMethod::Multipole;
+            ++i;
+        }
+        else if (arg == "--integrator" && has_value && std::strcmp(argv[i + 1], "euler") == 0)
+        {
+            opt.integrator = Integrator::Euler;
+            ++i;
+        }
+        else if (arg == "--integrator" && has_value && std::strcmp(argv[i + 1], "leapfrog") == 0)
+        {
+            opt.integrator = Integrator::Leapfrog;
+            ++i;
+        }
+        else if (arg == "--integrator" && has_value && std::strcmp(argv[i + 1], "yoshida4") == 0)
+        {
+            opt.integrator = Integrator::Yoshida4;
+            ++i;
+        }
+        else if (arg == "--preset" && has_value && std::strcmp(argv[i + 1], "bimodal") == 0)
+        {
+            opt.preset = InitialPreset::BimodalDisk;
+            ++i;
+        }
+        else if (arg == "--preset" && has_value && std::strcmp(argv[i + 1], "plummer") == 0)
+        {
+            opt.preset = InitialPreset::Plummer;
+            ++i;
+        }
+        else if (arg == "--preset" && has_value && std::strcmp(argv[i + 1], "uniform") == 0)
+        {
+            opt.preset = InitialPreset::UniformDisk;
+            ++i;
+        }
+        else if (arg == "--curve" && has_value && std::strcmp(argv[i + 1], "morton") == 0)
+        {
+            opt.curve = CurveOrder::Morton;
+            ++i;
+        }
+        else if (arg == "--curve" && has_value && std::strcmp(argv[i + 1], "hilbert") == 0)
+        {
+            opt.curve = CurveOrder::Hilbert;
+            ++i;
+        }
+        else
+        {
+            std::cerr << "Unknown or incomplete option: " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (opt.bodies < 0 || opt.steps < 0 || opt.threads < 0 || opt.reorder < 0 || opt.dt <= 0.0f ||
+        opt.block_levels < 0 || opt.block_levels > 16 || opt.timestep_accuracy <= 0.0f ||
+        opt.energy < 0 || opt.checkpoint < 0 || opt.trajectory < 0 || opt.trajectory_bits < 1 ||
+        opt.trajectory_bits > 24 || opt.stats_interval < 0 ||
+        opt.direct_crossover < 0 || opt.ranks < 0 || opt.rebalance < 0 || opt.leaf_size < 0 || opt.radius <= 0.0f)
+    {
+        std::cerr << "Invalid option value" << std::endl;
+        return false;
+    }
+
+    if (opt.leaf_size == 0)
+        opt.leaf_size = opt.force == ForceMethod::Multipole ? static_cast<int>(FMM_LEAF_SIZE) : 1;
+
+    const bool distributed = opt.ranks > 0 || opt.mpi;
+    if (distributed && (opt.block_levels > 0 || opt.energy > 0 || opt.checkpoint > 0 ||
+                        !opt.restart.empty() || opt.trajectory > 0 || opt.collision))
+    {
+        std::cerr << "Distributed runs do not support block steps, energy, checkpoints, trajectories or collisions" << std::endl;
+        return false;
+    }
+#ifndef NBODY_MPI
+    if (opt.mpi)
+    {
+        std::cerr << "Built without NBODY_MPI, --mpi is unavailable" << std::endl;
+        return false;
+    }
+#endif
+    return true;
+}
+
+InitialConditions initial_conditions(const Options &opt)
+{
+    InitialConditions ic;
+    ic.preset = opt.preset;
+    ic.radius = opt.radius;
+    ic.seed = opt.seed;
+    return ic;
+}
+
+const char *preset_name(InitialPreset preset)
+{
+    return preset == InitialPreset::BimodalDisk ? "bimodal" : preset == InitialPreset::Plummer ? "plummer" : "uniform";
+}
+
+void configure(Simulation &sim, const Options &opt)
+{
+    sim.parallel_build = !opt.serial_build;
+    sim.reorder_interval = opt.reorder;
+    sim.reorder_curve = opt.curve;
+    sim.group_walk = !opt.scalar_walk;
+    sim.force_method = opt.force;
+    sim.incremental_tree = opt.incremental;
+    sim.max_timestep_level = opt.block_levels;
+    sim.timestep_accuracy = opt.timestep_accuracy;
+    sim.integrator = opt.integrator;
+    sim.energy_interval = opt.energy;
+    sim.tree_collisions = !opt.grid_collisions;
+    sim.direct_crossover = static_cast<size_t>(opt.direct_crossover);
+    sim.qt.leaf_size = static_cast<size_t>(opt.leaf_size);
+    sim.qt.balance_by_cost = opt.balance;
+    sim.stats.enabled = opt.stats;
+    sim.stats.export_path = opt.stats_path;
+    sim.stats.export_interval = opt.stats_interval;
+}
+
+// Mean milliseconds per step of each phase over the recorded steps
+void print_stats(const StatsRecorder &stats)
+{
+    const StepStats mean = stats.mean();
+    std::cout << "phase_ms";
+    for (int p = 0; p < PHASE_COUNT; ++p)
+        std::cout << " " << PHASE_NAMES[p] << "=" << mean.phase_seconds[p] * 1e3;
+    std::cout << " step=" << mean.step_seconds * 1e3 << std::endl;
+    std::cout << "tree nodes=" << mean.tree_nodes
+              << " leaves=" << mean.tree_leaves
+              << " depth=" << mean.tree_depth
+              << " mean_walk_visits=" << mean.mean_walk_visits()
+              << " max_walk_visits=" << mean.max_walk_visits
+              << " collision_pairs=" << mean.collision_pairs
+              << " merged=" << mean.merged_bodies << std::endl;
+    if (NBODY_COUNT_ALLOCATIONS)
+        std::cout << "allocations mean=" << mean.allocations
+                  << " last=" << stats.latest().allocations << std::endl;
+}
+
+// One rank of a distributed run, collective over the transport. Only rank 0
+// prints; its stats cover its own share of the bodies.
+template <typename Transport>
+void run_distributed(Transport &transport, const char *name, const Options &opt, const std::vector<Body> &initial)
+{
+    DistributedSimulation<Transport> dist(transport, initial, opt.dt, opt.theta, opt.epsilon);
+    configure(dist.sim, opt);
+    dist.rebalance_interval = opt.rebalance;
+
+    if (transport.rank() == 0)
+        std::cout << "bodies=" << initial.size()
+                  << " steps=" << opt.steps
+                  << " dt=" << opt.dt
+                  << " theta=" << opt.theta
+                  << " epsilon=" << opt.epsilon
+                  << " ranks=" << transport.size()
+                  << " transport=" << name
+                  << " rebalance=" << opt.rebalance
+                  << " threads_per_rank=" << omp_get_max_threads()
+                  << " preset=" << preset_name(opt.preset)
+                  << " seed=" << opt.seed
+                  << " simd=" << FORCE_SIMD_WIDTH << std::endl;
+
+    double body_updates = 0.0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < opt.steps; i++)
+    {
+        body_updates += static_cast<double>(dist.sim.soa.size());
+        dist.step();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    struct RankTotals
+    {
+        double body_updates;
+        uint64_t bodies, force_evals, migrated, imported;
+        double seconds;
+    };
+    std::vector<RankTotals> ranks;
+    dist.all_gather(RankTotals{body_updates, dist.sim.soa.size(), dist.sim.force_evaluations,
+                               dist.migrated, dist.imported, seconds},
+                    ranks);
+    if (transport.rank() != 0)
+        return;
+
+    // The slowest rank sets the pace
+    RankTotals total = {};
+    size_t min_bodies = std::numeric_limits<size_t>::max(), max_bodies = 0;
+    for (const RankTotals &r : ranks)
+    {
+        total.body_updates += r.body_updates;
+        total.bodies += r.bodies;
+        total.force_evals += r.force_evals;
+        total.migrated += r.migrated;
+        total.imported += r.imported;
+        total.seconds = std::max(total.seconds, r.seconds);
+        min_bodies = std::min<size_t>(min_bodies, r.bodies);
+        max_bodies = std::max<size_t>(max_bodies, r.bodies);
+    }
+
+    std::cout << "elapsed=" << total.seconds << "s"
+              << " steps/sec=" << (total.seconds > 0.0 ? opt.steps / total.seconds : 0.0)
+              << " body-updates/sec=" << (total.seconds > 0.0 ? total.body_updates / total.seconds : 0.0)
+              << " force_evals=" << total.force_evals
+              << " final_bodies=" << total.bodies
+              << " rank_bodies=" << min_bodies << ".." << max_bodies
+              << " decompositions=" << dist.decompositions
+              << " migrated=" << total.migrated
+              << " essential_per_step=" << (opt.steps > 0 ? total.imported / opt.steps : 0) << std::endl;
+
+    if (opt.stats && dist.sim.stats.size() > 0)
+    {
+        std::cout << "rank 0 ";
+        print_stats(dist.sim.stats);
+        if (!opt.stats_path.empty())
+            dist.sim.stats.export_file();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    if (!parse_options(argc, argv, opt))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (opt.threads > 0)
+        omp_set_num_threads(opt.threads);
+
+    // Distributed runs start with every body on rank 0, the first step
+    // spreads them over the ranks
+    if (opt.mpi)
+    {
+#ifdef NBODY_MPI
+        MPI_Init(&argc, &argv);
+        {
+            MpiTransport transport;
+            std::vector<Body> initial;
+            if (transport.rank() == 0)
+            {
+                initial.reserve(opt.bodies + 1);
+                opt.seed = initializeBodies(initial, opt.bodies, initial_conditions(opt));
+            }
+            run_distributed(transport, "mpi", opt, initial);
+        }
+        MPI_Finalize();
+#endif
+        return 0;
+    }
+
+    if (opt.ranks > 0)
+    {
+        std::vector<Body> initial;
+        initial.reserve(opt.bodies + 1);
+        opt.seed = initializeBodies(initial, opt.bodies, initial_conditions(opt));
+
+        LoopbackHub hub(opt.ranks);
+        const int threads_per_rank = std::max(1, omp_get_max_threads() / opt.ranks);
+        std::vector<std::thread> workers;
+        for (int r = 0; r < opt.ranks; ++r)
+        {
+            workers.emplace_back([&, r]
+                                 {
+                                     omp_set_num_threads(threads_per_rank);
+                                     LoopbackTransport transport(hub, r);
+                                     run_distributed(transport, "loopback", opt, r == 0 ? initial : std::vector<Body>()); });
+        }
+        for (std::thread &worker : workers)
+            worker.join();
+        return 0;
+    }
+
+    // A restart takes its bodies, dt, theta and epsilon from the checkpoint
+    std::vector<Body> bodies;
+    MappedCheckpoint restart;
+    const auto load_start = std::chrono::steady_clock::now();
+    if (!opt.restart.empty())
+    {
+        if (!restart.open(opt.restart))
+            return -1;
+        opt.dt = restart.header().dt;
+        opt.theta = restart.header().theta;
+        opt.epsilon = restart.header().epsilon;
+    }
+    else
+    {
+        bodies.reserve(opt.bodies + 1);
+        opt.seed = initializeBodies(bodies, opt.bodies, initial_conditions(opt));
+    }
+
+    Simulation sim(static_cast<int>(bodies.size()), opt.dt, bodies, opt.theta, opt.epsilon, opt.collision);
+    if (!opt.restart.empty())
+    {
+        restart.restore(sim);
+        restart.close();
+    }
+    const double load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start).count();
+
+    configure(sim, opt);
+    if (opt.stats && !NBODY_STATS)
+        std::cerr << "Built with NBODY_STATS=0, --stats records nothing" << std::endl;
+    sim.trajectory.bits = opt.trajectory_bits;
+    if (opt.trajectory > 0 && !sim.trajectory.open(opt.trajectory_path, opt.trajectory))
+        return -1;
+
+    std::cout << "bodies=" << sim.soa.size()
+              << " steps=" << opt.steps
+              << " dt=" << opt.dt
+              << " theta=" << opt.theta
+              << " epsilon=" << opt.epsilon
+              << " collision=" << (opt.collision ? (opt.grid_collisions ? "grid" : "tree") : "off")
+              << " threads=" << omp_get_max_threads()
+              << " build=" << (opt.serial_build ? "serial" : "parallel")
+              << " reorder=" << opt.reorder
+              << (opt.curve == CurveOrder::Hilbert ? "/hilbert" : "/morton")
+              << " force=" << (opt.force == ForceMethod::BarnesHut ? "bh" : opt.force == ForceMethod::Quadrupole ? "quad" : "fmm")
+              << " block_levels=" << opt.block_levels
+              << " integrator=" << (opt.integrator == Integrator::Euler ? "euler" : opt.integrator == Integrator::Leapfrog ? "leapfrog" : "yoshida4")
+              << " walk=" << (opt.scalar_walk || opt.serial_build ? "scalar" : "group")
+              << " leaf_size=" << opt.leaf_size
+              << " balance=" << (opt.balance ? "cost" : "count")
+              << " simd=" << FORCE_SIMD_WIDTH;
+    if (opt.restart.empty())
+        std::cout << " preset=" << preset_name(opt.preset) << " seed=" << opt.seed;
+    std::cout << (opt.restart.empty() ? " init=" : " restart=") << load_seconds << "s"
+              << " from_frame=" << sim.frame << std::endl;
+
+    CheckpointWriter checkpoints;
+
+    // Bodies can merge during the run, so count the updates step by step
+    double body_updates = 0.0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < opt.steps; i++)
+    {
+        body_updates += static_cast<double>(sim.soa.size());
+        sim.step();
+        if (opt.checkpoint > 0 && (i + 1) % opt.checkpoint == 0)
+            checkpoints.save(sim, opt.checkpoint_path);
+    }
+    checkpoints.wait();
+    const auto end = std::chrono::steady_clock::now();
+
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    const double steps_per_sec = seconds > 0.0 ? opt.steps / seconds : 0.0;
+    const double updates_per_sec = seconds > 0.0 ? body_updates / seconds : 0.0;
+
+    std::cout << "elapsed=" << seconds << "s"
+              << " steps/sec=" << steps_per_sec
+              << " body-updates/sec=" << updates_per_sec
+              << " force_evals=" << sim.force_evaluations
+              << " final_bodies=" << sim.soa.size()
+              << " tree_builds=" << sim.qt.builds
+              << " tree_refits=" << sim.qt.refits;
+    if (opt.checkpoint > 0)
+        std::cout << " checkpoints=" << checkpoints.written
+                  << " superseded=" << checkpoints.superseded;
+    if (opt.trajectory > 0)
+    {
+        // Closing drains the queue, so only the recording itself is timed
+        sim.trajectory.close();
+        std::cout << " trajectory_frames=" << sim.trajectory.recorded
+                  << " trajectory_dropped=" << sim.trajectory.dropped
+                  << " trajectory_bytes=" << sim.trajectory.bytes;
+    }
+    if (opt.energy > 0)
+        std::cout << " energy_drift=" << sim.energy_drift
+                  << " max_energy_drift=" << sim.max_energy_drift;
+    std::cout << std::endl;
+
+    if (opt.stats && sim.stats.size() > 0)
+    {
+        print_stats(sim.stats);
+        if (!opt.stats_path.empty())
+            sim.stats.export_file();
+    }
+
+    return 0;
+}
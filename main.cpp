@@ -12,12 +12,15 @@
 #include "body.h"
 #include "simulation.h"
 #include "utils.h"
+#include "renderer.h"
+#include "sim_thread.h"
 
 const GLuint WIDTH = 1024, HEIGHT = 768;
 const float INITIAL_CAM_SCALE = 50.0;
 
 const int NUM_BODIES = 100000;
 const float DT = 0.01;
+const int STEPS_PER_FRAME = 1;
 const bool COLLISION = false;
 
 const float X_MEAN = NUM_BODIES <= 25000 ? 10.0 : 15.0;
@@ -26,13 +29,19 @@ const float Y_MEAN = 0.0;
 const float Y_STD = NUM_BODIES <= 25000 ? 5.0 : 10.0;
 const float MASS_SUN = 10000.0;
 
-void render(const std::vector<Body> &bodies)
+// Simulation commands are edge-triggered: one message per key press
+void key_callback(GLFWwindow *window, int key, int, int action, int)
 {
-    for (const auto &body : bodies)
-    {
-        glColor3f(body.color.r, body.color.g, body.color.b);
-        drawCircle(body.position.x, body.position.y, body.radius, 100);
-    }
+    if (action != GLFW_PRESS)
+        return;
+
+    SimulationThread *sim_thread = static_cast<SimulationThread *>(glfwGetWindowUserPointer(window));
+    if (key == GLFW_KEY_SPACE)
+        sim_thread->send(SimCommand::TogglePause);
+    else if (key == GLFW_KEY_RIGHT_BRACKET)
+        sim_thread->send(SimCommand::MoreSteps);
+    else if (key == GLFW_KEY_LEFT_BRACKET)
+        sim_thread->send(SimCommand::FewerSteps);
 }
 
 int main()
@@ -67,34 +76,41 @@ int main()
     }
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
+    Renderer renderer;
+    if (!renderer.init())
+        std::cerr << "GLSL unavailable, drawing fixed-function circles" << std::endl;
+
     float camX = 0.0f, camY = 0.0f;
     float camScale = INITIAL_CAM_SCALE;
-    int timeFactor = 1;
-    bool shouldMove = false;
 
     std::vector<Body> bodies;
     initializeBodies(bodies, NUM_BODIES);
     bodies.reserve(NUM_BODIES + 1);
 
+    // The simulation only runs on sim_thread from here on, starting paused
     Simulation sim(NUM_BODIES, DT, bodies);
+    SimulationThread sim_thread(sim, STEPS_PER_FRAME);
+    glfwSetWindowUserPointer(window, &sim_thread);
+    glfwSetKeyCallback(window, key_callback);
+    sim_thread.start();
 
     while (!glfwWindowShouldClose(window))
     {
         glClear(GL_COLOR_BUFFER_BIT);
 
-        controls(window, &camScale, &camX, &camY, INITIAL_CAM_SCALE, &shouldMove);
+        controls(window, &camScale, &camX, &camY, INITIAL_CAM_SCALE);
 
-        if (shouldMove)
-            sim.step();
-        render(bodies);
-
-        // std::cout << bodies.size() << std::endl;
+        // The projection spans 2 * camScale world units vertically
+        renderer.draw(sim_thread.latest().sprites, fbHeight / (2.0f * camScale));
+        sim_thread.request_frame();
 
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
+    sim_thread.stop();
+    renderer.destroy();
     glfwTerminate();
 
     return 0;
-}
\ No newline at end of file
+}
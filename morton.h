@@ -0,0 +1,80 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <utility>
+
+// Bits per axis of a Morton key; a 32-bit key spans 16 tree levels
+constexpr int MORTON_BITS = 16;
+constexpr uint32_t MORTON_CELLS = 1u << MORTON_BITS;
+
+// Spread the low 16 bits of v so that bit i moves to bit 2i
+uint32_t morton_spread(uint32_t v)
+{
+    v &= 0x0000ffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+// Interleave x into even bits and y into odd bits, so each 2-bit digit
+// matches the quadrant numbering of Quad::find_quadrant
+uint32_t morton_encode(uint32_t x, uint32_t y)
+{
+    return morton_spread(x) | (morton_spread(y) << 1);
+}
+
+// Clamp a cell coordinate to the grid
+uint32_t quantize_cell(float f)
+{
+    if (f <= 0.0f)
+        return 0u;
+    if (f >= static_cast<float>(MORTON_CELLS - 1))
+        return MORTON_CELLS - 1;
+    return static_cast<uint32_t>(f);
+}
+
+// Quantize a position inside the square [min, min + size] to a Morton key
+uint32_t morton_key(const glm::vec2 &pos, const glm::vec2 &min, float inv_cell)
+{
+    const uint32_t x = quantize_cell((pos.x - min.x) * inv_cell);
+    const uint32_t y = quantize_cell((pos.y - min.y) * inv_cell);
+    return morton_encode(x, y);
+}
+
+// Hilbert index of (x, y) on the MORTON_CELLS x MORTON_CELLS grid. Unlike
+// Morton order, consecutive keys are always adjacent cells.
+uint32_t hilbert_encode(uint32_t x, uint32_t y)
+{
+    uint32_t d = 0;
+    for (uint32_t s = MORTON_CELLS / 2; s > 0; s /= 2)
+    {
+        const uint32_t rx = (x & s) > 0;
+        const uint32_t ry = (y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+
+        // Rotate the quadrant so the curve stays continuous
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = MORTON_CELLS - 1 - x;
+                y = MORTON_CELLS - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+uint32_t hilbert_key(const glm::vec2 &pos, const glm::vec2 &min, float inv_cell)
+{
+    const uint32_t x = quantize_cell((pos.x - min.x) * inv_cell);
+    const uint32_t y = quantize_cell((pos.y - min.y) * inv_cell);
+    return hilbert_encode(x, y);
+}
+
+#endif
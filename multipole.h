@@ -0,0 +1,118 @@
+#ifndef MULTIPOLE_H
+#define MULTIPOLE_H
+
+#include <glm/glm.hpp>
+#include <cmath>
+
+// Derivatives of the softened force kernel used by Quadtree::acc,
+// K(d) = d f(r) with f(r) = 1 / ((r^2 + e^2) r), written in u = r^2:
+//   dK_k/dd_j        = delta_jk f + d_j d_k h
+//   d2K_k/dd_j dd_l  = h (delta_jk d_l + delta_kl d_j + delta_jl d_k) + g d_j d_k d_l
+// with h = f'(r) / r and g = h'(r) / r.
+struct KernelDerivatives
+{
+    float f;
+    float h;
+    float g;
+};
+
+KernelDerivatives kernel_derivatives(float u, float e_2)
+{
+    const float w = 1.0f / (u + e_2);
+    const float inv_r = 1.0f / std::sqrt(u);
+    const float inv_u = 1.0f / u;
+
+    KernelDerivatives k;
+    k.f = inv_r * w;
+    k.h = -inv_r * w * (inv_u + 2.0f * w);
+    k.g = inv_r * w * (3.0f * inv_u * inv_u + 4.0f * inv_u * w + 8.0f * w * w);
+    return k;
+}
+
+// Second mass moment about a center of mass: sum m (p - c)(p - c)^T,
+// stored as (xx, xy, yy)
+struct Moment
+{
+    float xx = 0.0f;
+    float xy = 0.0f;
+    float yy = 0.0f;
+
+    // Add a point mass m at offset d from the center
+    void add(const glm::vec2 &d, float m)
+    {
+        xx += m * d.x * d.x;
+        xy += m * d.x * d.y;
+        yy += m * d.y * d.y;
+    }
+
+    void add(const Moment &o)
+    {
+        xx += o.xx;
+        xy += o.xy;
+        yy += o.yy;
+    }
+};
+
+// Quadrupole term of the acceleration from a cell with second moment s seen
+// at offset d (cell center of mass minus target):
+//   1/2 [h (2 S d + tr(S) d) + g (d^T S d) d]
+// The dipole term vanishes because moments are taken about the center of mass.
+glm::vec2 quadrupole_acc(const glm::vec2 &d, const Moment &s, const KernelDerivatives &k)
+{
+    const glm::vec2 sd(s.xx * d.x + s.xy * d.y, s.xy * d.x + s.yy * d.y);
+    const float trace = s.xx + s.yy;
+    const float dsd = glm::dot(d, sd);
+    return 0.5f * (k.h * (2.0f * sd + trace * d) + k.g * dsd * d);
+}
+
+// Second-order local (Taylor) expansion of the acceleration field about a
+// cell center c: a(c + x) = l0 + L1 x + 1/2 L2(x, x). L1 is symmetric
+// (xx, xy, yy) and L2 fully symmetric (xxx, xxy, xyy, yyy).
+struct LocalExpansion
+{
+    glm::vec2 l0 = glm::vec2(0.0f);
+    float l1[3] = {0.0f, 0.0f, 0.0f};
+    float l2[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+
+    // Add the field of mass m with moment s at offset d from the center
+    void add_source(const glm::vec2 &d, float m, const Moment &s, float e_2)
+    {
+        const float u = glm::dot(d, d);
+        if (!(u > 0.0f))
+            return;
+
+        const KernelDerivatives k = kernel_derivatives(u, e_2);
+        l0 += m * k.f * d + quadrupole_acc(d, s, k);
+
+        // The target moves against d, hence the minus sign on the Jacobian
+        l1[0] -= m * (k.f + d.x * d.x * k.h);
+        l1[1] -= m * (d.x * d.y * k.h);
+        l1[2] -= m * (k.f + d.y * d.y * k.h);
+
+        l2[0] += m * (3.0f * k.h * d.x + k.g * d.x * d.x * d.x);
+        l2[1] += m * (k.h * d.y + k.g * d.x * d.x * d.y);
+        l2[2] += m * (k.h * d.x + k.g * d.x * d.y * d.y);
+        l2[3] += m * (3.0f * k.h * d.y + k.g * d.y * d.y * d.y);
+    }
+
+    glm::vec2 evaluate(const glm::vec2 &x) const
+    {
+        const glm::vec2 first(l1[0] * x.x + l1[1] * x.y, l1[1] * x.x + l1[2] * x.y);
+        const glm::vec2 second(l2[0] * x.x * x.x + 2.0f * l2[1] * x.x * x.y + l2[2] * x.y * x.y,
+                               l2[1] * x.x * x.x + 2.0f * l2[2] * x.x * x.y + l2[3] * x.y * x.y);
+        return l0 + first + 0.5f * second;
+    }
+
+    // Accumulate this expansion, re-centered at offset t, into child
+    void translate_into(const glm::vec2 &t, LocalExpansion &child) const
+    {
+        child.l0 += evaluate(t);
+        child.l1[0] += l1[0] + l2[0] * t.x + l2[1] * t.y;
+        child.l1[1] += l1[1] + l2[1] * t.x + l2[2] * t.y;
+        child.l1[2] += l1[2] + l2[2] * t.x + l2[3] * t.y;
+        for (int i = 0; i < 4; ++i)
+            child.l2[i] += l2[i];
+    }
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Command-line helpers shared by the batch drivers
+
+enum class ListValues
+{
+    Positive, // Sizes, spreads, masses, theta
+    Any       // Any finite value, e.g. disk means
+};
+
+// Comma-separated list of numbers into values. Fails on an empty list, an
+// item that is not a number, a non-finite value, one that allowed rejects,
+// or, for integral T, one that is fractional or out of T's range.
+template <typename T>
+bool parse_list(const char *text, std::vector<T> &values, ListValues allowed = ListValues::Positive)
+{
+    values.clear();
+    std::stringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+        char *end = nullptr;
+        const double v = std::strtod(item.c_str(), &end);
+        if (end == item.c_str() || *end != '\0' || !std::isfinite(v))
+            return false;
+        if (allowed == ListValues::Positive && v <= 0.0)
+            return false;
+        // 2^digits is one past T's maximum and exact as a double, unlike
+        // the maximum of a 64-bit T
+        if (std::is_integral<T>::value &&
+            (v != std::floor(v) || v < static_cast<double>(std::numeric_limits<T>::min()) ||
+             v >= std::ldexp(1.0, std::numeric_limits<T>::digits)))
+            return false;
+        values.push_back(static_cast<T>(v));
+    }
+    return !values.empty();
+}
+
+#endif
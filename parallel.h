@@ -0,0 +1,228 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <utility>
+#include <omp.h>
+
+// Contiguous [begin, end) slice of n items owned by thread t of nt
+std::pair<size_t, size_t> thread_range(size_t n, int t, int nt)
+{
+    const size_t chunk = (n + nt - 1) / nt;
+    const size_t begin = std::min(n, chunk * t);
+    const size_t end = std::min(n, begin + chunk);
+    return {begin, end};
+}
+
+// Reserve room for n elements in scratch reused across frames, with
+// headroom so a slowly growing size stops reallocating
+template <typename T>
+void reserve_scratch(std::vector<T> &v, size_t n)
+{
+    if (n > v.capacity())
+        v.reserve(n + n / 2);
+}
+
+// In-place exclusive prefix sum, returns the total. partial is per-thread
+// scratch the caller keeps across calls.
+template <typename T>
+T parallel_exclusive_scan(std::vector<T> &values, std::vector<T> &partial)
+{
+    const size_t n = values.size();
+    if (n == 0)
+        return T(0);
+
+    partial.assign(omp_get_max_threads() + 1, T(0));
+    T total = T(0);
+
+#pragma omp parallel
+    {
+        const int t = omp_get_thread_num();
+        const int nt = omp_get_num_threads();
+        const auto [begin, end] = thread_range(n, t, nt);
+
+        T sum = T(0);
+        for (size_t i = begin; i < end; ++i)
+            sum += values[i];
+        partial[t + 1] = sum;
+
+#pragma omp barrier
+#pragma omp single
+        {
+            for (int i = 1; i <= nt; ++i)
+                partial[i] += partial[i - 1];
+            total = partial[nt];
+        }
+
+        T running = partial[t];
+        for (size_t i = begin; i < end; ++i)
+        {
+            const T v = values[i];
+            values[i] = running;
+            running += v;
+        }
+    }
+
+    return total;
+}
+
+// Contiguous ranges of items 0..n-1 with about equal total cost, for loops
+// whose work per item is uneven: range p is [bounds[p], bounds[p + 1]).
+// Callers schedule the ranges dynamically, which absorbs what the cost
+// model misses.
+class CostPartition
+{
+public:
+    size_t parts_per_thread = 4;
+    std::vector<size_t> bounds;
+
+    size_t parts() const { return bounds.empty() ? 0 : bounds.size() - 1; }
+
+    // cost(i) is the expected work of item i, zero for items to skip
+    template <typename Cost>
+    void split(size_t n, Cost cost)
+    {
+        const size_t parts = std::max<size_t>(1, std::min(n, parts_per_thread * omp_get_max_threads()));
+        reserve_scratch(prefix, n);
+        prefix.resize(n);
+#pragma omp parallel for
+        for (size_t i = 0; i < n; ++i)
+            prefix[i] = cost(i);
+        const uint64_t total = parallel_exclusive_scan(prefix, partial);
+
+        // Range p starts at the first item past p / parts of the total
+        bounds.resize(parts + 1);
+        bounds[0] = 0;
+        bounds[parts] = n;
+        for (size_t p = 1; p < parts; ++p)
+            bounds[p] = std::lower_bound(prefix.begin(), prefix.end(), total * p / parts) - prefix.begin();
+    }
+
+private:
+    std::vector<uint64_t> prefix, partial;
+};
+
+// Stable parallel counting sort of item indices 0..n-1 by keys[i] < key_count.
+// Fills CSR offsets: the items with key k are order[starts[k] .. starts[k + 1]).
+void counting_sort(const std::vector<uint32_t> &keys,
+                   size_t key_count,
+                   std::vector<uint32_t> &starts,
+                   std::vector<uint32_t> &order,
+                   std::vector<uint32_t> &hist)
+{
+    const size_t n = keys.size();
+    order.resize(n);
+    starts.resize(key_count + 1);
+    hist.resize(static_cast<size_t>(omp_get_max_threads()) * key_count);
+
+#pragma omp parallel
+    {
+        const int t = omp_get_thread_num();
+        const int nt = omp_get_num_threads();
+        const auto [begin, end] = thread_range(n, t, nt);
+        uint32_t *local = &hist[static_cast<size_t>(t) * key_count];
+
+        std::fill(local, local + key_count, 0);
+        for (size_t i = begin; i < end; ++i)
+            local[keys[i]]++;
+
+#pragma omp barrier
+#pragma omp single
+        {
+            // Offsets ordered by key, then by thread, keep the sort stable
+            uint32_t offset = 0;
+            for (size_t k = 0; k < key_count; ++k)
+            {
+                starts[k] = offset;
+                for (int j = 0; j < nt; ++j)
+                {
+                    uint32_t &count = hist[static_cast<size_t>(j) * key_count + k];
+                    const uint32_t c = count;
+                    count = offset;
+                    offset += c;
+                }
+            }
+            starts[key_count] = offset;
+        }
+
+        for (size_t i = begin; i < end; ++i)
+            order[local[keys[i]]++] = static_cast<uint32_t>(i);
+    }
+}
+
+// Stable parallel LSD radix sort of (key, value) pairs, 8 bits per pass.
+// Passes whose digit is identical for every key are skipped. The _tmp
+// arrays and the per-thread digit counts in hist are caller-kept scratch.
+void radix_sort_pairs(std::vector<uint32_t> &keys,
+                      std::vector<uint32_t> &values,
+                      std::vector<uint32_t> &keys_tmp,
+                      std::vector<uint32_t> &values_tmp,
+                      std::vector<size_t> &hist)
+{
+    const size_t n = keys.size();
+    keys_tmp.resize(n);
+    values_tmp.resize(n);
+    if (n <= 1)
+        return;
+
+    constexpr int RADIX = 256;
+    hist.resize(static_cast<size_t>(omp_get_max_threads()) * RADIX);
+
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        bool skip = false;
+
+#pragma omp parallel
+        {
+            const int t = omp_get_thread_num();
+            const int nt = omp_get_num_threads();
+            const auto [begin, end] = thread_range(n, t, nt);
+            size_t *local = &hist[static_cast<size_t>(t) * RADIX];
+
+            std::fill(local, local + RADIX, 0);
+            for (size_t i = begin; i < end; ++i)
+                local[(keys[i] >> shift) & (RADIX - 1)]++;
+
+#pragma omp barrier
+#pragma omp single
+            {
+                // Offsets ordered by digit, then by thread, keep the sort stable
+                size_t offset = 0;
+                for (int b = 0; b < RADIX; ++b)
+                {
+                    const size_t digit_start = offset;
+                    for (int j = 0; j < nt; ++j)
+                    {
+                        size_t &count = hist[static_cast<size_t>(j) * RADIX + b];
+                        const size_t c = count;
+                        count = offset;
+                        offset += c;
+                    }
+                    if (offset - digit_start == n)
+                        skip = true;
+                }
+            }
+
+            if (!skip)
+            {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    const size_t dst = local[(keys[i] >> shift) & (RADIX - 1)]++;
+                    keys_tmp[dst] = keys[i];
+                    values_tmp[dst] = values[i];
+                }
+            }
+        }
+
+        if (!skip)
+        {
+            keys.swap(keys_tmp);
+            values.swap(values_tmp);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+// Philox4x32-10 counter-based generator (Salmon et al., SC'11). Each output
+// block is a pure function of (key, counter), so the numbers for item i
+// come from counters (i, 0), (i, 1), ... under one key and any thread can
+// draw them without sharing state.
+using PhiloxBlock = std::array<uint32_t, 4>;
+
+PhiloxBlock philox4x32(PhiloxBlock ctr, uint32_t k0, uint32_t k1)
+{
+    for (int round = 0; round < 10; ++round)
+    {
+        const uint64_t p0 = static_cast<uint64_t>(0xD2511F53u) * ctr[0];
+        const uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57u) * ctr[2];
+        ctr = {static_cast<uint32_t>(p1 >> 32) ^ ctr[1] ^ k0, static_cast<uint32_t>(p1),
+               static_cast<uint32_t>(p0 >> 32) ^ ctr[3] ^ k1, static_cast<uint32_t>(p0)};
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+    return ctr;
+}
+
+// Sequential draws for one item: block b is philox4x32((item, b, 0, 0), seed)
+class PhiloxStream
+{
+public:
+    PhiloxStream(uint64_t seed, uint32_t item)
+        : k0(static_cast<uint32_t>(seed)), k1(static_cast<uint32_t>(seed >> 32)), item(item)
+    {
+    }
+
+    uint32_t next()
+    {
+        if (used == 4)
+        {
+            block = philox4x32({item, counter++, 0, 0}, k0, k1);
+            used = 0;
+        }
+        return block[used++];
+    }
+
+    // Top 24 bits, exact in a float: [0, 1)
+    float uniform()
+    {
+        return static_cast<float>(next() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    float uniform(float lo, float hi)
+    {
+        return lo + (hi - lo) * uniform();
+    }
+
+    // Box-Muller; draws two uniforms per call so the draw count is fixed
+    float normal(float mean, float std)
+    {
+        const float u1 = 1.0f - uniform(); // (0, 1], log stays finite
+        const float u2 = uniform();
+        return mean + std * std::sqrt(-2.0f * std::log(u1)) * std::cos(6.2831853f * u2);
+    }
+
+private:
+    uint32_t k0, k1;
+    uint32_t item;
+    uint32_t counter = 0;
+    PhiloxBlock block = {};
+    int used = 4;
+};
+
+#endif
@@ -3,10 +3,19 @@
 
 #include <glm/glm.hpp>
 #include <vector>
+#include <array>
+#include <algorithm>
 #include <limits>
 #include <cmath>
-#include "body.h"
+#include <cstdint>
+#include "body_soa.h"
+#include "morton.h"
+#include "parallel.h"
+#include "force.h"
+#include "multipole.h"
+#include "stats.h"
 #include <iostream>
+#include <omp.h>
 
 class Quad
 {
@@ -36,55 +45,65 @@ public:
         return new_quad;
     }
 
-    std::vector<Quad> subdivide() const
+    std::array<Quad, 4> subdivide() const
     {
-        std::vector<Quad> quads;
-        quads.reserve(4);
-
-        for (int i = 0; i < 4; ++i)
-        {
-            quads.emplace_back(into_quadrant(i));
-        }
-        return quads;
+        return {into_quadrant(0), into_quadrant(1), into_quadrant(2), into_quadrant(3)};
     }
 };
 
-Quad new_quadtree(const std::vector<Body> &bodies)
+Quad new_quadtree(const BodySoA &bodies)
 {
     if (bodies.empty())
         return Quad(glm::vec2(0), 0.0f);
 
     // Initialize with first body's position
-    glm::vec2 min = bodies[0].position;
-    glm::vec2 max = min;
+    float min_x = bodies.x[0];
+    float min_y = bodies.y[0];
+    float max_x = min_x;
+    float max_y = min_y;
 
-    for (const auto &body : bodies)
+#pragma omp parallel for reduction(min : min_x, min_y) reduction(max : max_x, max_y)
+    for (size_t i = 0; i < bodies.size(); ++i)
     {
-        min = glm::min(min, body.position);
-        max = glm::max(max, body.position);
+        min_x = std::min(min_x, bodies.x[i]);
+        min_y = std::min(min_y, bodies.y[i]);
+        max_x = std::max(max_x, bodies.x[i]);
+        max_y = std::max(max_y, bodies.y[i]);
     }
 
+    const glm::vec2 min(min_x, min_y);
+    const glm::vec2 max(max_x, max_y);
+
     const glm::vec2 center = (min + max) * 0.5f;
     const float size = glm::max(max.x - min.x, max.y - min.y);
 
     return Quad(center, size);
 }
 
-class Node
+// Only the fields the force walk reads, with 32-bit indices: 32 bytes,
+// so two nodes fill a cache line and none straddles one. Quad centers,
+// needed only while building, live in Quadtree::centers.
+class alignas(32) Node
 {
 public:
-    size_t children;
-    size_t next;
     glm::vec2 pos;
-    Quad quad;
     float mass;
+    float size;
+    uint32_t children;
+    uint32_t next;
+    // Leaf bucket: Quadtree::buckets[first .. first + count), count is zero
+    // unless leaf_size > 1
+    uint32_t first;
+    uint32_t count;
 
-    Node(size_t next, const Quad &quad)
-        : children(0),
-          next(next),
-          pos(0.0f, 0.0f),
+    Node(uint32_t next, float size)
+        : pos(0.0f, 0.0f),
           mass(0.0f),
-          quad(quad)
+          size(size),
+          children(0),
+          next(next),
+          first(0),
+          count(0)
     {
     }
 
@@ -93,6 +112,8 @@ public:
     bool is_empty() const noexcept { return mass == 0.0f; }
 };
 
+static_assert(sizeof(Node) == 32, "Node should take half a cache line");
+
 class Quadtree
 {
 public:
@@ -100,19 +121,636 @@ public:
     const float t_2;
     const float e_2;
     std::vector<Node> nodes;
+    // Cold per-node data, parallel to nodes
+    std::vector<glm::vec2> centers;
+    std::vector<uint32_t> parent_of;
+    std::vector<uint8_t> depth_of;
     std::vector<size_t> parents;
 
+    // parents[levels[d] .. levels[d + 1]) were split at depth d by build()
+    std::vector<size_t> levels;
+
+    // Scratch reused by build() across frames
+    struct Range
+    {
+        size_t node;
+        uint32_t begin;
+        uint32_t end;
+    };
+    std::vector<uint32_t> keys, order, keys_tmp, order_tmp;
+    std::vector<size_t> sort_hist, scan_partial;
+    std::vector<Range> frontier, next_frontier;
+    std::vector<size_t> branch_rank, sorted_parents;
+
+    // Spatially compact runs of order[] that share one interaction list in
+    // acc_groups(): the highest subtrees holding at most group_size bodies
+    size_t group_size = 32;
+    std::vector<Range> groups;
+    size_t group_count = 0;
+    std::vector<InteractionList> lists;
+
+    // Leaf buckets: with leaf_size > 1, build() stops splitting ranges of at
+    // most that many bodies. A leaf the walks accept is one point mass, a
+    // leaf they open sums its bodies directly from buckets. Every bucket
+    // starts at a multiple of FORCE_SIMD_WIDTH and is padded with zero
+    // masses; bucket_body holds the body in each slot, NO_BODY in padding.
+    size_t leaf_size = 1;
+    InteractionList buckets;
+    std::vector<uint32_t> bucket_body, bucket_start, bucket_partial;
+    std::vector<uint32_t> regroup_order, regroup_start, regroup_hist;
+
+    // Second mass moments per node, filled by propagate_moments()
+    std::vector<Moment> moments;
+    // Leaf node holding each body, filled by build()
+    std::vector<uint32_t> leaf_of;
+
+    // Leaf bookkeeping for refit(): body count per leaf and its sole body
+    // (NO_BODY when empty, shared, or no longer known)
+    static constexpr uint32_t NO_BODY = std::numeric_limits<uint32_t>::max();
+    static constexpr int MAX_DEPTH = 32;
+    std::vector<uint32_t> occupancy;
+    std::vector<uint32_t> occupant;
+    std::vector<uint8_t> dirty;
+    std::vector<uint32_t> moved, shared;
+    std::vector<std::vector<uint32_t>> moved_local; // Per thread, kept across refits
+    bool refittable = false;
+    int max_depth = 0;
+
+    // A refit gives up, and the caller rebuilds, past these limits: share of
+    // bodies changing leaf, node count and depth relative to the last build()
+    float refit_max_moved = 0.1f;
+    float refit_max_growth = 1.25f;
+    int refit_max_depth_growth = 4;
+    size_t built_nodes = 0;
+    int built_depth = 0;
+    size_t builds = 0;
+    size_t refits = 0;
+
+    // Collision broadphase data from propagate_bounds(): body position
+    // bounds and largest radius per node, and the bodies of each leaf as
+    // leaf_bodies[leaf_start[node] .. leaf_start[node] + occupancy[node])
+    std::vector<glm::vec2> bounds_lo, bounds_hi;
+    std::vector<float> max_radius;
+    std::vector<uint32_t> leaf_start, leaf_cursor, leaf_bodies, leaf_partial;
+
+    // Nodes visited by the force walks since reset_walk_counters(), per
+    // thread; only counted while count_walks is set
+    struct alignas(64) WalkCounter
+    {
+        uint64_t walks = 0;
+        uint64_t visits = 0;
+        uint64_t max_visits = 0;
+    };
+    mutable std::vector<WalkCounter> walk_counters;
+    bool count_walks = false;
+
+    // The group walk and the collision scan run in ranges of about equal
+    // total BodySoA::cost, or of equal body count without balance_by_cost
+    bool balance_by_cost = true;
+    CostPartition group_partition, collision_partition;
+
     Quadtree(float theta, float epsilon)
         : t_2(theta * theta),
           e_2(epsilon * epsilon),
           nodes(),
           parents() {}
 
+    Quad quad(size_t node) const
+    {
+        return Quad(centers[node], nodes[node].size);
+    }
+
     void clear(const Quad &quad)
     {
         nodes.clear();
+        centers.clear();
+        parent_of.clear();
+        depth_of.clear();
+        occupancy.clear();
+        occupant.clear();
         parents.clear();
-        nodes.emplace_back(0, quad);
+        levels.clear();
+        refittable = false;
+        max_depth = 0;
+        push_node(Node(0, quad.size), quad.center, ROOT, 0);
+    }
+
+    void push_node(const Node &node, const glm::vec2 &center, size_t parent, int depth)
+    {
+        nodes.push_back(node);
+        centers.push_back(center);
+        parent_of.push_back(static_cast<uint32_t>(parent));
+        depth_of.push_back(static_cast<uint8_t>(depth));
+        occupancy.push_back(0);
+        occupant.push_back(NO_BODY);
+    }
+
+    void resize_nodes(size_t count)
+    {
+        reserve_scratch(nodes, count);
+        reserve_scratch(centers, count);
+        reserve_scratch(parent_of, count);
+        reserve_scratch(depth_of, count);
+        reserve_scratch(occupancy, count);
+        reserve_scratch(occupant, count);
+        nodes.resize(count, Node(0, 0.0f));
+        centers.resize(count);
+        parent_of.resize(count);
+        depth_of.resize(count);
+        occupancy.resize(count, 0);
+        occupant.resize(count, NO_BODY);
+    }
+
+    // Parallel alternative to clear() + insert(): sort bodies along a Morton
+    // curve, then emit the tree one level at a time. Children stay in
+    // contiguous groups of four with the same threaded next pointers that
+    // insert() produces. Bodies sharing a cell at MORTON_BITS depth collapse
+    // into one leaf at their center of mass.
+    void build(const BodySoA &bodies, const Quad &bounds)
+    {
+        clear(bounds);
+        const size_t n = bodies.size();
+        if (n == 0)
+            return;
+
+        const glm::vec2 min = bounds.center - glm::vec2(bounds.size * 0.5f);
+        const float inv_cell = bounds.size > 0.0f ? MORTON_CELLS / bounds.size : 0.0f;
+        const size_t bucket = std::max<size_t>(leaf_size, 1);
+
+        keys.resize(n);
+        order.resize(n);
+#pragma omp parallel for
+        for (size_t i = 0; i < n; ++i)
+        {
+            keys[i] = morton_key(bodies.position(i), min, inv_cell);
+            order[i] = static_cast<uint32_t>(i);
+        }
+        radix_sort_pairs(keys, order, keys_tmp, order_tmp, sort_hist);
+
+        leaf_of.resize(n);
+        groups.resize(n);
+        group_count = 0;
+        if (n <= group_size)
+            add_group(Range{ROOT, 0, static_cast<uint32_t>(n)});
+
+        frontier.assign(1, Range{ROOT, 0, static_cast<uint32_t>(n)});
+        for (int depth = 0; !frontier.empty(); ++depth)
+        {
+            const size_t count = frontier.size();
+            const bool can_split = depth < MORTON_BITS;
+
+            // A range splits if it overflows a leaf with bodies from more
+            // than one cell
+            reserve_scratch(branch_rank, count);
+            branch_rank.resize(count);
+#pragma omp parallel for
+            for (size_t i = 0; i < count; ++i)
+            {
+                const Range &r = frontier[i];
+                branch_rank[i] = can_split && r.end - r.begin > bucket && keys[r.begin] != keys[r.end - 1];
+            }
+            const size_t branches = parallel_exclusive_scan(branch_rank, scan_partial);
+
+            const size_t first_child = nodes.size();
+            const size_t first_parent = parents.size();
+            resize_nodes(first_child + 4 * branches);
+            if (branches > 0)
+                max_depth = depth + 1;
+            reserve_scratch(parents, first_parent + branches);
+            parents.resize(first_parent + branches);
+            levels.push_back(first_parent);
+            reserve_scratch(next_frontier, 4 * branches);
+            next_frontier.resize(4 * branches);
+
+            const int shift = 2 * (MORTON_BITS - 1 - depth);
+#pragma omp parallel for
+            for (size_t i = 0; i < count; ++i)
+            {
+                const Range r = frontier[i];
+                const size_t rank = branch_rank[i];
+                const size_t next_rank = i + 1 < count ? branch_rank[i + 1] : branches;
+
+                if (rank == next_rank)
+                {
+                    // Bodies collapsed into one deep cell form their own group
+                    if (r.end - r.begin > group_size)
+                        add_group(r);
+                    make_leaf(bodies, r);
+                    continue;
+                }
+
+                const size_t children = first_child + 4 * rank;
+                parents[first_parent + rank] = r.node;
+                Node &parent = nodes[r.node];
+                parent.children = static_cast<uint32_t>(children);
+                const Quad parent_quad = quad(r.node);
+
+                // Keys in a range share their prefix, so the digit at this
+                // depth is nondecreasing and each quadrant is a subrange
+                uint32_t begin = r.begin;
+                for (int q = 0; q < 4; ++q)
+                {
+                    const uint32_t end = q == 3 ? r.end : quadrant_end(begin, r.end, shift, q);
+                    const uint32_t next = q < 3 ? static_cast<uint32_t>(children + q + 1) : parent.next;
+                    const Quad child = parent_quad.into_quadrant(q);
+                    nodes[children + q] = Node(next, child.size);
+                    centers[children + q] = child.center;
+                    parent_of[children + q] = static_cast<uint32_t>(r.node);
+                    depth_of[children + q] = static_cast<uint8_t>(depth + 1);
+                    next_frontier[4 * rank + q] = Range{children + q, begin, end};
+                    if (r.end - r.begin > group_size && end > begin && end - begin <= group_size)
+                        add_group(next_frontier[4 * rank + q]);
+                    begin = end;
+                }
+            }
+
+            frontier.swap(next_frontier);
+        }
+        levels.push_back(parents.size());
+        groups.resize(group_count);
+        if (bucketed())
+            fill_buckets(bodies, order);
+
+        refittable = true;
+        built_nodes = nodes.size();
+        built_depth = max_depth;
+        builds++;
+    }
+
+    // Incremental alternative to build() for the next frame of the same
+    // bodies: keep the topology, move only bodies that left their leaf cell
+    // and refit the centers of mass of the subtrees that changed. Returns
+    // false when a full build() is needed instead.
+    bool refit(const BodySoA &bodies)
+    {
+        const size_t n = bodies.size();
+        if (!refittable || n != leaf_of.size())
+            return false;
+
+        // Bodies that left the root force a rebuild with new bounds
+        size_t outside = 0;
+        moved.clear();
+        moved_local.resize(omp_get_max_threads());
+#pragma omp parallel
+        {
+            std::vector<uint32_t> &local = moved_local[omp_get_thread_num()];
+            local.clear();
+#pragma omp for reduction(+ : outside) nowait
+            for (size_t i = 0; i < n; ++i)
+            {
+                const glm::vec2 pos = bodies.position(i);
+                if (!contains(ROOT, pos))
+                    outside++;
+                else if (!contains(leaf_of[i], pos))
+                    local.push_back(static_cast<uint32_t>(i));
+            }
+#pragma omp critical
+            moved.insert(moved.end(), local.begin(), local.end());
+        }
+
+        if (outside > 0 || moved.size() > refit_max_moved * n)
+        {
+            refittable = false;
+            return false;
+        }
+
+        // Relocate in body order so the result does not depend on threads
+        std::sort(moved.begin(), moved.end());
+        dirty.assign(nodes.size(), 0);
+        const size_t parent_count = parents.size();
+        for (const uint32_t b : moved)
+        {
+            relocate(bodies, b);
+        }
+
+        if (nodes.size() > refit_max_growth * built_nodes || max_depth > built_depth + refit_max_depth_growth)
+        {
+            refittable = false;
+            return false;
+        }
+
+        if (parents.size() != parent_count)
+            sort_levels();
+
+        if (bucketed())
+            update_buckets(bodies);
+
+        refit_leaves(bodies);
+        refit_parents();
+        refits++;
+        return true;
+    }
+
+    bool contains(size_t node, const glm::vec2 &pos) const
+    {
+        const glm::vec2 d = glm::abs(pos - centers[node]);
+        const float half = nodes[node].size * 0.5f;
+        return d.x <= half && d.y <= half;
+    }
+
+    // Move body b from its old leaf to the leaf now containing it, splitting
+    // a single-body leaf until the two bodies separate. Buckets overfill
+    // instead until the next build().
+    void relocate(const BodySoA &bodies, uint32_t b)
+    {
+        const uint32_t old = leaf_of[b];
+        occupancy[old]--;
+        if (occupant[old] == b)
+            occupant[old] = NO_BODY;
+        if (occupancy[old] == 0)
+            nodes[old].mass = 0.0f;
+        dirty[old] = 1;
+
+        const glm::vec2 pos = bodies.position(b);
+        size_t node = ROOT;
+        while (nodes[node].is_branch())
+        {
+            node = nodes[node].children + quad(node).find_quadrant(pos);
+        }
+
+        while (!bucketed() && occupancy[node] == 1 && occupant[node] != NO_BODY && depth_of[node] < MAX_DEPTH)
+        {
+            const uint32_t other = occupant[node];
+            const glm::vec2 p = bodies.position(other);
+            if (p == pos)
+                break;
+
+            const size_t children = subdivide(node);
+            dirty.resize(nodes.size(), 1);
+            const Quad q = quad(node);
+            const size_t n1 = children + q.find_quadrant(p);
+            occupancy[node] = 0;
+            occupant[node] = NO_BODY;
+            occupancy[n1] = 1;
+            occupant[n1] = other;
+            leaf_of[other] = static_cast<uint32_t>(n1);
+
+            node = children + q.find_quadrant(pos);
+        }
+
+        occupancy[node]++;
+        occupant[node] = occupancy[node] == 1 ? b : NO_BODY;
+        leaf_of[b] = static_cast<uint32_t>(node);
+        dirty[node] = 1;
+    }
+
+    // Leaves with one body copy it, shared leaves sum their bodies
+    void refit_leaves(const BodySoA &bodies)
+    {
+        if (bucketed())
+        {
+            refit_bucket_leaves();
+            return;
+        }
+
+        shared.clear();
+
+#pragma omp parallel for
+        for (size_t i = 0; i < bodies.size(); ++i)
+        {
+            const uint32_t leaf = leaf_of[i];
+            if (occupancy[leaf] != 1)
+            {
+#pragma omp critical
+                shared.push_back(static_cast<uint32_t>(i));
+                continue;
+            }
+
+            Node &n = nodes[leaf];
+            const glm::vec2 pos = bodies.position(i);
+            if (n.pos != pos || n.mass != bodies.mass[i])
+            {
+                n.pos = pos;
+                n.mass = bodies.mass[i];
+                dirty[leaf] = 1;
+            }
+        }
+
+        // Group shared leaves' bodies together, in body order within a leaf
+        std::sort(shared.begin(), shared.end(),
+                  [&](uint32_t a, uint32_t b)
+                  {
+                      return leaf_of[a] != leaf_of[b] ? leaf_of[a] < leaf_of[b] : a < b;
+                  });
+
+        for (size_t k = 0; k < shared.size();)
+        {
+            const uint32_t leaf = leaf_of[shared[k]];
+            glm::vec2 pos_sum(0.0f);
+            float mass_sum = 0.0f;
+            for (; k < shared.size() && leaf_of[shared[k]] == leaf; ++k)
+            {
+                pos_sum += bodies.position(shared[k]) * bodies.mass[shared[k]];
+                mass_sum += bodies.mass[shared[k]];
+            }
+
+            if (mass_sum > 0.0f)
+                nodes[leaf].pos = pos_sum / mass_sum;
+            nodes[leaf].mass = mass_sum;
+            dirty[leaf] = 1;
+        }
+    }
+
+    // Centers of mass of the leaves from their buckets
+    void refit_bucket_leaves()
+    {
+#pragma omp parallel for schedule(dynamic, 256)
+        for (size_t node = 0; node < nodes.size(); ++node)
+        {
+            Node &n = nodes[node];
+            if (n.is_branch() || n.count == 0)
+                continue;
+
+            glm::vec2 pos_sum(0.0f);
+            float mass_sum = 0.0f;
+            for (uint32_t k = n.first; k < n.first + n.count; ++k)
+            {
+                pos_sum += glm::vec2(buckets.x[k], buckets.y[k]) * buckets.mass[k];
+                mass_sum += buckets.mass[k];
+            }
+            // The walks take a one-body leaf as a point mass at n.pos, which
+            // must be the body's own position exactly, as in refit_leaves()
+            const glm::vec2 pos = n.count == 1 || mass_sum <= 0.0f ? glm::vec2(buckets.x[n.first], buckets.y[n.first])
+                                                                   : pos_sum / mass_sum;
+            if (n.pos != pos || n.mass != mass_sum)
+            {
+                n.pos = pos;
+                n.mass = mass_sum;
+                dirty[node] = 1;
+            }
+        }
+    }
+
+    // Center-of-mass pass restricted to parents with a changed child
+    void refit_parents()
+    {
+        for (size_t l = levels.size(); l-- > 1;)
+        {
+#pragma omp parallel for
+            for (size_t k = levels[l - 1]; k < levels[l]; ++k)
+            {
+                const size_t node = parents[k];
+                const size_t c = nodes[node].children;
+                if (dirty[c] | dirty[c + 1] | dirty[c + 2] | dirty[c + 3])
+                {
+                    propagate_node(node);
+                    dirty[node] = 1;
+                }
+            }
+        }
+    }
+
+    // Regroup parents by depth after refit() split new ones off
+    void sort_levels()
+    {
+        levels.assign(static_cast<size_t>(max_depth) + 2, 0);
+        for (const size_t p : parents)
+            levels[depth_of[p] + 1]++;
+        for (size_t d = 1; d < levels.size(); ++d)
+            levels[d] += levels[d - 1];
+
+        branch_rank.assign(levels.begin(), levels.end() - 1);
+        reserve_scratch(sorted_parents, parents.size());
+        sorted_parents.resize(parents.size());
+        for (const size_t p : parents)
+            sorted_parents[branch_rank[depth_of[p]]++] = p;
+        std::copy(sorted_parents.begin(), sorted_parents.end(), parents.begin());
+    }
+
+    void add_group(const Range &r)
+    {
+        size_t slot;
+#pragma omp atomic capture
+        slot = group_count++;
+        groups[slot] = r;
+    }
+
+    // First index in [begin, end) whose key digit at shift exceeds q
+    uint32_t quadrant_end(uint32_t begin, uint32_t end, int shift, int q) const
+    {
+        const auto it = std::partition_point(keys.begin() + begin, keys.begin() + end,
+                                             [&](uint32_t k)
+                                             { return static_cast<int>((k >> shift) & 3) <= q; });
+        return static_cast<uint32_t>(it - keys.begin());
+    }
+
+    bool bucketed() const { return leaf_size > 1; }
+
+    static size_t padded(size_t count)
+    {
+        return (count + FORCE_SIMD_WIDTH - 1) / FORCE_SIMD_WIDTH * FORCE_SIMD_WIDTH;
+    }
+
+    // Copy the occupancy[leaf] bodies listed at source[nodes[leaf].first]
+    // into each leaf's bucket, then point first at the bucket
+    void fill_buckets(const BodySoA &bodies, const std::vector<uint32_t> &source)
+    {
+        const size_t count = nodes.size();
+        bucket_start.resize(count);
+#pragma omp parallel for
+        for (size_t node = 0; node < count; ++node)
+        {
+            bucket_start[node] = nodes[node].is_leaf() ? static_cast<uint32_t>(padded(occupancy[node])) : 0;
+        }
+        const size_t total = parallel_exclusive_scan(bucket_start, bucket_partial);
+
+        reserve_scratch(buckets.x, total);
+        reserve_scratch(buckets.y, total);
+        reserve_scratch(buckets.mass, total);
+        reserve_scratch(bucket_body, total);
+        buckets.x.resize(total);
+        buckets.y.resize(total);
+        buckets.mass.resize(total);
+        bucket_body.resize(total);
+
+#pragma omp parallel for schedule(dynamic, 256)
+        for (size_t node = 0; node < count; ++node)
+        {
+            Node &leaf = nodes[node];
+            if (leaf.is_branch())
+                continue;
+
+            const uint32_t from = leaf.first;
+            const uint32_t to = bucket_start[node];
+            leaf.first = to;
+            leaf.count = occupancy[node];
+            for (uint32_t j = 0; j < leaf.count; ++j)
+            {
+                const uint32_t b = source[from + j];
+                buckets.x[to + j] = bodies.x[b];
+                buckets.y[to + j] = bodies.y[b];
+                buckets.mass[to + j] = bodies.mass[b];
+                bucket_body[to + j] = b;
+            }
+            for (size_t j = leaf.count; j < padded(leaf.count); ++j)
+            {
+                buckets.x[to + j] = 0.0f;
+                buckets.y[to + j] = 0.0f;
+                buckets.mass[to + j] = 0.0f;
+                bucket_body[to + j] = NO_BODY;
+            }
+        }
+    }
+
+    // Bring the buckets up to date after refit() relocated the moved bodies:
+    // regroup the bodies by leaf if any changed leaf, else copy positions
+    void update_buckets(const BodySoA &bodies)
+    {
+        if (!moved.empty())
+        {
+            // Stable, so each bucket keeps its bodies in index order
+            counting_sort(leaf_of, nodes.size(), regroup_start, regroup_order, regroup_hist);
+#pragma omp parallel for
+            for (size_t node = 0; node < nodes.size(); ++node)
+            {
+                if (nodes[node].is_leaf())
+                    nodes[node].first = regroup_start[node];
+            }
+            fill_buckets(bodies, regroup_order);
+            return;
+        }
+
+#pragma omp parallel for
+        for (size_t k = 0; k < bucket_body.size(); ++k)
+        {
+            const uint32_t b = bucket_body[k];
+            if (b == NO_BODY)
+                continue;
+            buckets.x[k] = bodies.x[b];
+            buckets.y[k] = bodies.y[b];
+            buckets.mass[k] = bodies.mass[b];
+        }
+    }
+
+    void make_leaf(const BodySoA &bodies, const Range &r)
+    {
+        nodes[r.node].first = r.begin; // Into order[] until fill_buckets()
+        if (r.begin == r.end)
+            return;
+
+        for (uint32_t k = r.begin; k < r.end; ++k)
+            leaf_of[order[k]] = static_cast<uint32_t>(r.node);
+        occupancy[r.node] = r.end - r.begin;
+        occupant[r.node] = r.end - r.begin == 1 ? order[r.begin] : NO_BODY;
+
+        Node &leaf = nodes[r.node];
+        if (r.end - r.begin == 1)
+        {
+            leaf.pos = bodies.position(order[r.begin]);
+            leaf.mass = bodies.mass[order[r.begin]];
+            return;
+        }
+
+        glm::vec2 pos_sum(0.0f);
+        float mass_sum = 0.0f;
+        for (uint32_t k = r.begin; k < r.end; ++k)
+        {
+            const uint32_t b = order[k];
+            pos_sum += bodies.position(b) * bodies.mass[b];
+            mass_sum += bodies.mass[b];
+        }
+        leaf.pos = mass_sum > 0.0f ? pos_sum / mass_sum : bodies.position(order[r.begin]);
+        leaf.mass = mass_sum;
     }
 
     void insert(const glm::vec2 &pos, float mass)
@@ -121,7 +759,7 @@ public:
 
         while (nodes[node].is_branch())
         {
-            const int quadrant = nodes[node].quad.find_quadrant(pos);
+            const int quadrant = quad(node).find_quadrant(pos);
             node = nodes[node].children + quadrant;
         }
 
@@ -132,7 +770,9 @@ public:
             return;
         }
 
-        const auto [p, m] = std::tie(nodes[node].pos, nodes[node].mass);
+        // Copy, not reference: subdivide() may reallocate nodes
+        const glm::vec2 p = nodes[node].pos;
+        const float m = nodes[node].mass;
         if (pos == p)
         {
             nodes[node].mass += mass;
@@ -142,8 +782,9 @@ public:
         while (true)
         {
             const size_t children = subdivide(node);
-            const int q1 = nodes[node].quad.find_quadrant(p);
-            const int q2 = nodes[node].quad.find_quadrant(pos);
+            const Quad q = quad(node);
+            const int q1 = q.find_quadrant(p);
+            const int q2 = q.find_quadrant(pos);
 
             if (q1 != q2)
             {
@@ -163,20 +804,22 @@ public:
     {
         parents.push_back(node);
         const size_t children = nodes.size();
-        nodes[node].children = children;
+        nodes[node].children = static_cast<uint32_t>(children);
 
-        const std::array<size_t, 4> nexts = {
-            children + 1,
-            children + 2,
-            children + 3,
+        const std::array<uint32_t, 4> nexts = {
+            static_cast<uint32_t>(children + 1),
+            static_cast<uint32_t>(children + 2),
+            static_cast<uint32_t>(children + 3),
             nodes[node].next,
         };
 
-        const auto quads = nodes[node].quad.subdivide();
+        const auto quads = quad(node).subdivide();
+        const int depth = depth_of[node] + 1;
         for (size_t i = 0; i < 4; ++i)
         {
-            nodes.emplace_back(nexts[i], quads[i]);
+            push_node(Node(nexts[i], quads[i].size), quads[i].center, node, depth);
         }
+        max_depth = std::max(max_depth, depth);
 
         return children;
     }
@@ -185,38 +828,465 @@ public:
     {
         for (auto it = parents.rbegin(); it != parents.rend(); ++it)
         {
-            const size_t node = *it;
-            const size_t i = nodes[node].children;
+            propagate_node(*it);
+        }
+    }
 
-            glm::vec2 pos_sum(0.0f);
-            float mass_sum = 0.0f;
+    // Center-of-mass pass for trees from build(): nodes on one level only
+    // read the level below, so each level runs in parallel
+    void propagate_levels()
+    {
+        for (size_t l = levels.size(); l-- > 1;)
+        {
+#pragma omp parallel for
+            for (size_t k = levels[l - 1]; k < levels[l]; ++k)
+            {
+                propagate_node(parents[k]);
+            }
+        }
+    }
 
-            for (size_t j = 0; j < 4; ++j)
+    // Upward pass for second moments, after the center-of-mass pass. A
+    // bucket leaf sums its bodies, any other leaf holds a point mass.
+    void propagate_moments()
+    {
+        moments.assign(nodes.size(), Moment());
+        if (bucketed())
+        {
+#pragma omp parallel for schedule(dynamic, 256)
+            for (size_t node = 0; node < nodes.size(); ++node)
             {
-                pos_sum += nodes[i + j].pos * nodes[i + j].mass;
-                mass_sum += nodes[i + j].mass;
+                if (nodes[node].is_leaf() && nodes[node].count > 1)
+                    moments[node] = leaf_moment(node);
             }
+        }
+
+        if (levels.empty())
+        {
+            for (auto it = parents.rbegin(); it != parents.rend(); ++it)
+                propagate_moment(*it);
+            return;
+        }
+
+        for (size_t l = levels.size(); l-- > 1;)
+        {
+#pragma omp parallel for
+            for (size_t k = levels[l - 1]; k < levels[l]; ++k)
+            {
+                propagate_moment(parents[k]);
+            }
+        }
+    }
+
+    Moment leaf_moment(size_t node) const
+    {
+        const Node &leaf = nodes[node];
+        Moment s;
+        for (uint32_t k = leaf.first; k < leaf.first + leaf.count; ++k)
+            s.add(glm::vec2(buckets.x[k], buckets.y[k]) - leaf.pos, buckets.mass[k]);
+        return s;
+    }
+
+    void propagate_moment(size_t node)
+    {
+        const size_t i = nodes[node].children;
+        Moment s;
+
+        for (size_t j = 0; j < 4; ++j)
+        {
+            const Node &child = nodes[i + j];
+            if (child.is_empty())
+                continue;
+            s.add(moments[i + j]);
+            s.add(child.pos - nodes[node].pos, child.mass);
+        }
+
+        moments[node] = s;
+    }
+
+    void propagate_node(size_t node)
+    {
+        const size_t i = nodes[node].children;
+
+        glm::vec2 pos_sum(0.0f);
+        float mass_sum = 0.0f;
 
+        for (size_t j = 0; j < 4; ++j)
+        {
+            pos_sum += nodes[i + j].pos * nodes[i + j].mass;
+            mass_sum += nodes[i + j].mass;
+        }
+
+        // A refit can empty every child of a branch
+        if (mass_sum > 0.0f)
             nodes[node].pos = pos_sum / mass_sum;
-            nodes[node].mass = mass_sum;
+        nodes[node].mass = mass_sum;
+    }
+
+    // Fill the collision broadphase data for a tree from build() or refit()
+    void propagate_bounds(const BodySoA &bodies)
+    {
+        const size_t count = nodes.size();
+        leaf_start.assign(occupancy.begin(), occupancy.end());
+        parallel_exclusive_scan(leaf_start, leaf_partial);
+        leaf_cursor.assign(leaf_start.begin(), leaf_start.end());
+        leaf_bodies.resize(bodies.size());
+
+#pragma omp parallel for
+        for (size_t i = 0; i < bodies.size(); ++i)
+        {
+            uint32_t slot;
+#pragma omp atomic capture
+            slot = leaf_cursor[leaf_of[i]]++;
+            leaf_bodies[slot] = static_cast<uint32_t>(i);
+        }
+
+        bounds_lo.resize(count);
+        bounds_hi.resize(count);
+        max_radius.resize(count);
+
+        // Empty nodes get inverted bounds that overlap nothing
+#pragma omp parallel for schedule(dynamic, 256)
+        for (size_t node = 0; node < count; ++node)
+        {
+            glm::vec2 lo(std::numeric_limits<float>::max());
+            glm::vec2 hi(-std::numeric_limits<float>::max());
+            float r = 0.0f;
+            if (nodes[node].is_leaf())
+            {
+                for (uint32_t k = leaf_start[node]; k < leaf_start[node] + occupancy[node]; ++k)
+                {
+                    const uint32_t b = leaf_bodies[k];
+                    lo = glm::min(lo, bodies.position(b));
+                    hi = glm::max(hi, bodies.position(b));
+                    r = std::max(r, bodies.radius[b]);
+                }
+            }
+            bounds_lo[node] = lo;
+            bounds_hi[node] = hi;
+            max_radius[node] = r;
+        }
+
+        for (size_t l = levels.size(); l-- > 1;)
+        {
+#pragma omp parallel for
+            for (size_t k = levels[l - 1]; k < levels[l]; ++k)
+            {
+                const size_t node = parents[k];
+                const size_t c = nodes[node].children;
+                for (size_t j = 0; j < 4; ++j)
+                {
+                    bounds_lo[node] = glm::min(bounds_lo[node], bounds_lo[c + j]);
+                    bounds_hi[node] = glm::max(bounds_hi[node], bounds_hi[c + j]);
+                    max_radius[node] = std::max(max_radius[node], max_radius[c + j]);
+                }
+            }
         }
     }
 
-    glm::vec2 acc(const glm::vec2 &pos) const
+    // Call hit(i, j) once for every pair of bodies whose discs touch, from
+    // several threads at once; returns the number of pairs. Each occupied
+    // leaf walks the tree, skipping subtrees whose bounds grown by their
+    // radius cannot reach it, and tests the leaves it reaches from its own
+    // index on. A leaf's walk is assumed to cost what its bodies' force
+    // walks did, both grow with the density around it.
+    template <typename Hit>
+    size_t collision_pairs(const BodySoA &bodies, Hit hit)
+    {
+        collision_partition.split(nodes.size(), [&](size_t a)
+                                  {
+                                      uint64_t c = 0;
+                                      if (nodes[a].is_leaf())
+                                          for (uint32_t k = leaf_start[a]; k < leaf_start[a] + occupancy[a]; ++k)
+                                              c += body_cost(bodies, leaf_bodies[k]);
+                                      return c;
+                                  });
+        size_t pairs = 0;
+
+#pragma omp parallel for schedule(dynamic, 1) reduction(+ : pairs)
+        for (size_t p = 0; p < collision_partition.parts(); ++p)
+        {
+            for (size_t a = collision_partition.bounds[p]; a < collision_partition.bounds[p + 1]; ++a)
+            {
+                if (nodes[a].is_leaf() && occupancy[a] > 0)
+                    pairs += leaf_collisions(bodies, a, hit);
+            }
+        }
+
+        return pairs;
+    }
+
+    // Pairs between leaf a and the leaves from a on that it may touch
+    template <typename Hit>
+    size_t leaf_collisions(const BodySoA &bodies, size_t a, Hit &hit) const
+    {
+        size_t pairs = 0;
+        const glm::vec2 lo = bounds_lo[a] - glm::vec2(max_radius[a]);
+        const glm::vec2 hi = bounds_hi[a] + glm::vec2(max_radius[a]);
+        size_t node = ROOT;
+
+        while (true)
+        {
+            const Node &n = nodes[node];
+            const glm::vec2 reach(max_radius[node]);
+            const glm::vec2 n_lo = bounds_lo[node] - reach;
+            const glm::vec2 n_hi = bounds_hi[node] + reach;
+            const bool overlap = n_lo.x <= hi.x && n_lo.y <= hi.y && n_hi.x >= lo.x && n_hi.y >= lo.y;
+
+            if (overlap && n.is_branch())
+            {
+                node = n.children;
+                continue;
+            }
+
+            if (overlap && node >= a)
+                pairs += leaf_pairs(bodies, a, node, hit);
+
+            if (n.next == 0)
+                break;
+
+            node = n.next;
+        }
+
+        return pairs;
+    }
+
+    template <typename Hit>
+    size_t leaf_pairs(const BodySoA &bodies, size_t a, size_t b, Hit &hit) const
+    {
+        size_t pairs = 0;
+        const uint32_t a_end = leaf_start[a] + occupancy[a];
+        const uint32_t b_end = leaf_start[b] + occupancy[b];
+
+        for (uint32_t k = leaf_start[a]; k < a_end; ++k)
+        {
+            const uint32_t i = leaf_bodies[k];
+            for (uint32_t m = a == b ? k + 1 : leaf_start[b]; m < b_end; ++m)
+            {
+                const uint32_t j = leaf_bodies[m];
+                const float dx = bodies.x[i] - bodies.x[j];
+                const float dy = bodies.y[i] - bodies.y[j];
+                const float radius_sum = bodies.radius[i] + bodies.radius[j];
+                if (dx * dx + dy * dy <= radius_sum * radius_sum)
+                {
+                    hit(i, j);
+                    ++pairs;
+                }
+            }
+        }
+
+        return pairs;
+    }
+
+    void reset_walk_counters()
+    {
+        walk_counters.assign(omp_get_max_threads(), WalkCounter());
+    }
+
+    void count_walk(uint64_t visits) const
+    {
+#if NBODY_STATS
+        const size_t t = static_cast<size_t>(omp_get_thread_num());
+        if (!count_walks || t >= walk_counters.size())
+            return;
+        WalkCounter &c = walk_counters[t];
+        c.walks++;
+        c.visits += visits;
+        c.max_visits = std::max(c.max_visits, visits);
+#else
+        (void)visits;
+#endif
+    }
+
+    // Weight of body b in the cost-balanced partitions, at least one
+    uint64_t body_cost(const BodySoA &bodies, uint32_t b) const
+    {
+        return balance_by_cost ? std::max<uint32_t>(bodies.cost[b], 1) : 1;
+    }
+
+    size_t leaf_count() const
+    {
+        size_t leaves = 0;
+#pragma omp parallel for reduction(+ : leaves)
+        for (size_t i = 0; i < nodes.size(); ++i)
+            leaves += nodes[i].is_leaf();
+        return leaves;
+    }
+
+    // Group walk for trees from build(): each group gathers one interaction
+    // list by testing nodes against its bounding box, then every body in the
+    // group evaluates that list with the SIMD kernel from force.h. A non-empty
+    // active mask limits the walk to the flagged bodies. Each body's cost is
+    // the length of its list.
+    void acc_groups(BodySoA &bodies, const std::vector<uint8_t> &active = std::vector<uint8_t>())
+    {
+        lists.resize(omp_get_max_threads());
+        const bool all = active.empty();
+        group_partition.split(groups.size(), [&](size_t g)
+                              {
+                                  uint64_t c = 0;
+                                  for (uint32_t k = groups[g].begin; k < groups[g].end; ++k)
+                                      if (all || active[order[k]])
+                                          c += body_cost(bodies, order[k]);
+                                  return c;
+                              });
+
+#pragma omp parallel
+        {
+            InteractionList &list = lists[omp_get_thread_num()];
+
+#pragma omp for schedule(dynamic, 1)
+            for (size_t p = 0; p < group_partition.parts(); ++p)
+            {
+                for (size_t g = group_partition.bounds[p]; g < group_partition.bounds[p + 1]; ++g)
+                {
+                    const Range &r = groups[g];
+
+                    // Bounds of the active bodies only, groups without any are skipped
+                    glm::vec2 lo(std::numeric_limits<float>::max());
+                    glm::vec2 hi(-std::numeric_limits<float>::max());
+                    for (uint32_t k = r.begin; k < r.end; ++k)
+                    {
+                        if (!all && !active[order[k]])
+                            continue;
+                        lo = glm::min(lo, bodies.position(order[k]));
+                        hi = glm::max(hi, bodies.position(order[k]));
+                    }
+                    if (lo.x > hi.x)
+                        continue;
+
+                    interaction_list(lo, hi, list);
+
+                    for (uint32_t k = r.begin; k < r.end; ++k)
+                    {
+                        const uint32_t b = order[k];
+                        if (!all && !active[b])
+                            continue;
+                        float ax = 0.0f;
+                        float ay = 0.0f;
+                        accumulate(list, bodies.x[b], bodies.y[b], e_2, ax, ay);
+                        bodies.ax[b] = ax;
+                        bodies.ay[b] = ay;
+                        bodies.cost[b] = static_cast<uint32_t>(list.size());
+                    }
+                }
+            }
+        }
+    }
+
+    // Nodes every point in [lo, hi] may treat as a single mass. The opening
+    // test uses the nearest point of the box, so it is at least as strict as
+    // the per-body test in acc() for each body inside it.
+    void interaction_list(const glm::vec2 &lo, const glm::vec2 &hi, InteractionList &list) const
+    {
+        list.clear();
+        size_t node = ROOT;
+        uint64_t visited = 0;
+
+        while (true)
+        {
+            ++visited;
+            const Node &n = nodes[node];
+            const glm::vec2 d = n.pos - glm::clamp(n.pos, lo, hi);
+            const float d_sq = glm::dot(d, d);
+            const bool far = n.size * n.size < d_sq * t_2;
+
+            if (n.is_leaf() || far)
+            {
+                if (!far && n.count > 1)
+                    list.append(buckets, n.first, n.first + n.count);
+                else if (!n.is_empty())
+                    list.push_back(n.pos.x, n.pos.y, n.mass);
+
+                if (n.next == 0)
+                    break;
+
+                node = n.next;
+            }
+            else
+            {
+                node = n.children;
+            }
+        }
+
+        count_walk(visited);
+        list.pad();
+    }
+
+    // acc() with a quadrupole correction for accepted branch nodes and
+    // bucket leaves, needs propagate_moments()
+    glm::vec2 acc_quadrupole(const glm::vec2 &pos, uint32_t *work = nullptr) const
+    {
+        glm::vec2 acceleration(0.0f);
+        size_t node = ROOT;
+        uint64_t visited = 0;
+        uint64_t summed = 0;
+
+        while (true)
+        {
+            ++visited;
+            const Node &n = nodes[node];
+            const glm::vec2 d = n.pos - pos;
+            const float d_sq = glm::dot(d, d);
+            const bool far = n.size * n.size < d_sq * t_2;
+
+            if (n.is_leaf() || far)
+            {
+                const float denom = (d_sq + e_2) * std::sqrt(d_sq);
+                if (!far && n.count > 1)
+                {
+                    accumulate(buckets, n.first, n.first + padded(n.count), pos.x, pos.y, e_2, acceleration.x, acceleration.y);
+                    summed += n.count;
+                }
+                else if (denom > 0.0f)
+                {
+                    acceleration += d * std::min(n.mass / denom, std::numeric_limits<float>::max());
+                    if (n.is_branch() || n.count > 1)
+                        acceleration += quadrupole_acc(d, moments[node], kernel_derivatives(d_sq, e_2));
+                }
+
+                if (n.next == 0)
+                    break;
+
+                node = n.next;
+            }
+            else
+            {
+                node = n.children;
+            }
+        }
+
+        count_walk(visited);
+        if (work)
+            *work = static_cast<uint32_t>(visited + summed);
+        return acceleration;
+    }
+
+    // work, if given, receives the nodes visited plus the bucket bodies summed
+    glm::vec2 acc(const glm::vec2 &pos, uint32_t *work = nullptr) const
     {
         glm::vec2 acceleration(0.0f);
         size_t node = ROOT;
+        uint64_t visited = 0;
+        uint64_t summed = 0;
 
         while (true)
         {
+            ++visited;
             const Node &n = nodes[node];
             const glm::vec2 d = n.pos - pos;
             const float d_sq = glm::dot(d, d);
+            const bool far = n.size * n.size < d_sq * t_2;
 
-            if (n.is_leaf() || (n.quad.size * n.quad.size < d_sq * t_2))
+            if (n.is_leaf() || far)
             {
                 const float denom = (d_sq + e_2) * std::sqrt(d_sq);
-                if (denom > 0.0f)
+                if (!far && n.count > 1)
+                {
+                    accumulate(buckets, n.first, n.first + padded(n.count), pos.x, pos.y, e_2, acceleration.x, acceleration.y);
+                    summed += n.count;
+                }
+                else if (denom > 0.0f)
                 {
                     acceleration += d * std::min(n.mass / denom, std::numeric_limits<float>::max());
                 }
@@ -232,8 +1302,64 @@ public:
             }
         }
 
+        count_walk(visited);
+        if (work)
+            *work = static_cast<uint32_t>(visited + summed);
         return acceleration;
     }
+
+    // Potential per unit mass at pos, consistent with the kernel in acc():
+    // -m / e (pi / 2 - atan(r / e)), which is -m / r without softening.
+    // Summed in double, the sun's term would swamp the rest in float.
+    double potential(const glm::vec2 &pos) const
+    {
+        const float e = std::sqrt(e_2);
+        double phi = 0.0;
+        size_t node = ROOT;
+
+        while (true)
+        {
+            const Node &n = nodes[node];
+            const glm::vec2 d = n.pos - pos;
+            const float d_sq = glm::dot(d, d);
+            const bool far = n.size * n.size < d_sq * t_2;
+
+            if (n.is_leaf() || far)
+            {
+                if (!far && n.count > 1)
+                {
+                    for (uint32_t k = n.first; k < n.first + n.count; ++k)
+                    {
+                        const glm::vec2 dk = glm::vec2(buckets.x[k], buckets.y[k]) - pos;
+                        phi += point_potential(glm::dot(dk, dk), buckets.mass[k], e);
+                    }
+                }
+                else
+                {
+                    phi += point_potential(d_sq, n.mass, e);
+                }
+
+                if (n.next == 0)
+                    break;
+
+                node = n.next;
+            }
+            else
+            {
+                node = n.children;
+            }
+        }
+
+        return phi;
+    }
+
+    static float point_potential(float d_sq, float mass, float e)
+    {
+        if (d_sq <= 0.0f)
+            return 0.0f;
+        const float r = std::sqrt(d_sq);
+        return e > 0.0f ? -mass / e * (1.57079633f - std::atan(r / e)) : -mass / r;
+    }
 };
 
 #endif
\ No newline at end of file
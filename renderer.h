@@ -0,0 +1,307 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <GL/glew.h>
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include "snapshot.h"
+
+// Draws every body as one point sprite, shaded into a circle by the
+// fragment shader. Sprites stream through a persistently mapped ring of
+// buffer regions when GL 4.4 / ARB_buffer_storage is available, otherwise
+// through an orphaned VBO. Without GLSL the bodies become indexed triangle
+// fans around a unit circle computed once on the CPU.
+class Renderer
+{
+public:
+    static constexpr int CIRCLE_SEGMENTS = 12;
+    static constexpr int REGIONS = 3;
+
+    bool init()
+    {
+        for (int i = 0; i <= CIRCLE_SEGMENTS; ++i)
+        {
+            const float theta = 2.0f * static_cast<float>(M_PI) * i / CIRCLE_SEGMENTS;
+            circle_x.push_back(std::cos(theta));
+            circle_y.push_back(std::sin(theta));
+        }
+
+        use_shader = GLEW_VERSION_2_0 && build_program();
+        persistent = use_shader && (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage);
+        if (use_shader)
+        {
+            glGenBuffers(1, &vbo);
+            // Needed for gl_PointSize and gl_PointCoord in compatibility contexts
+            glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+            glEnable(GL_POINT_SPRITE);
+        }
+        return use_shader;
+    }
+
+    // pixels_per_unit converts world lengths to framebuffer pixels
+    void draw(const std::vector<Sprite> &sprites, float pixels_per_unit)
+    {
+        const size_t count = sprites.size();
+        if (count == 0)
+            return;
+
+        if (!use_shader)
+        {
+            draw_fixed_function(sprites);
+            return;
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        size_t first = 0;
+        // Growing the mapping can fail and turn persistent off
+        if (persistent && count > capacity)
+            allocate_persistent(count);
+
+        if (persistent)
+        {
+            region = (region + 1) % REGIONS;
+            wait_region(region);
+            first = region * capacity;
+            std::memcpy(mapped + first, sprites.data(), count * sizeof(Sprite));
+        }
+        else
+        {
+            glBufferData(GL_ARRAY_BUFFER, count * sizeof(Sprite), nullptr, GL_STREAM_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(Sprite), sprites.data());
+        }
+
+        glUseProgram(program);
+        glUniform1f(pixels_per_unit_location, pixels_per_unit);
+        glEnableVertexAttribArray(0);
+        glEnableVertexAttribArray(1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Sprite), reinterpret_cast<const void *>(offsetof(Sprite, x)));
+        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(Sprite), reinterpret_cast<const void *>(offsetof(Sprite, radius)));
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Sprite), reinterpret_cast<const void *>(offsetof(Sprite, r)));
+
+        glDrawArrays(GL_POINTS, static_cast<GLint>(first), static_cast<GLsizei>(count));
+
+        glDisableVertexAttribArray(0);
+        glDisableVertexAttribArray(1);
+        glDisableVertexAttribArray(2);
+        glUseProgram(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        if (persistent)
+            fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    void destroy()
+    {
+        for (GLsync &fence : fences)
+        {
+            if (fence)
+                glDeleteSync(fence);
+            fence = nullptr;
+        }
+        if (vbo)
+            glDeleteBuffers(1, &vbo);
+        if (program)
+            glDeleteProgram(program);
+        vbo = 0;
+        program = 0;
+    }
+
+private:
+    bool use_shader = false;
+    bool persistent = false;
+    GLuint program = 0;
+    GLint pixels_per_unit_location = -1;
+    GLuint vbo = 0;
+
+    // Persistent ring: REGIONS slices of capacity sprites each, one per
+    // frame in flight, each guarded by the fence of the frame that read it
+    Sprite *mapped = nullptr;
+    size_t capacity = 0;
+    int region = 0;
+    GLsync fences[REGIONS] = {};
+
+    // Fixed-function path
+    std::vector<float> circle_x, circle_y;
+    std::vector<float> fan_vertices, fan_colors;
+    std::vector<GLuint> fan_indices;
+
+    void allocate_persistent(size_t count)
+    {
+        for (int i = 0; i < REGIONS; ++i)
+            wait_region(i);
+        if (mapped)
+        {
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            glDeleteBuffers(1, &vbo);
+            glGenBuffers(1, &vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        }
+
+        // Headroom so a growing body count does not reallocate every frame
+        capacity = count + count / 4;
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        const GLsizeiptr bytes = static_cast<GLsizeiptr>(REGIONS * capacity * sizeof(Sprite));
+        glBufferStorage(GL_ARRAY_BUFFER, bytes, nullptr, flags);
+        mapped = static_cast<Sprite *>(glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags));
+
+        if (!mapped)
+        {
+            std::cerr << "Persistent mapping failed, using glBufferSubData" << std::endl;
+            persistent = false;
+            capacity = 0;
+            glDeleteBuffers(1, &vbo);
+            glGenBuffers(1, &vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        }
+    }
+
+    void wait_region(int r)
+    {
+        if (!fences[r])
+            return;
+        while (glClientWaitSync(fences[r], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+        {
+        }
+        glDeleteSync(fences[r]);
+        fences[r] = nullptr;
+    }
+
+    bool build_program()
+    {
+        const char *vertex_source =
+            "#version 120\n"
+            "attribute vec2 position;\n"
+            "attribute float radius;\n"
+            "attribute vec3 color;\n"
+            "uniform float pixels_per_unit;\n"
+            "varying vec3 v_color;\n"
+            "void main()\n"
+            "{\n"
+            "    gl_Position = gl_ModelViewProjectionMatrix * vec4(position, 0.0, 1.0);\n"
+            "    gl_PointSize = max(2.0 * radius * pixels_per_unit, 1.0);\n"
+            "    v_color = color;\n"
+            "}\n";
+        const char *fragment_source =
+            "#version 120\n"
+            "varying vec3 v_color;\n"
+            "void main()\n"
+            "{\n"
+            "    vec2 p = gl_PointCoord * 2.0 - 1.0;\n"
+            "    if (dot(p, p) > 1.0)\n"
+            "        discard;\n"
+            "    gl_FragColor = vec4(v_color, 1.0);\n"
+            "}\n";
+
+        const GLuint vertex = compile(GL_VERTEX_SHADER, vertex_source);
+        const GLuint fragment = compile(GL_FRAGMENT_SHADER, fragment_source);
+        if (!vertex || !fragment)
+            return false;
+
+        program = glCreateProgram();
+        glAttachShader(program, vertex);
+        glAttachShader(program, fragment);
+        glBindAttribLocation(program, 0, "position");
+        glBindAttribLocation(program, 1, "radius");
+        glBindAttribLocation(program, 2, "color");
+        glLinkProgram(program);
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked)
+        {
+            std::cerr << "Sprite shader failed to link, using fixed-function circles" << std::endl;
+            glDeleteProgram(program);
+            program = 0;
+            return false;
+        }
+
+        pixels_per_unit_location = glGetUniformLocation(program, "pixels_per_unit");
+        return true;
+    }
+
+    GLuint compile(GLenum type, const char *source)
+    {
+        const GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &source, nullptr);
+        glCompileShader(shader);
+
+        GLint compiled = GL_FALSE;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if (!compiled)
+        {
+            char log[1024];
+            glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+            std::cerr << "Sprite shader error: " << log << std::endl;
+            glDeleteShader(shader);
+            return 0;
+        }
+        return shader;
+    }
+
+    // One center plus CIRCLE_SEGMENTS + 1 rim vertices per body, drawn as
+    // indexed triangles from client-side arrays
+    void draw_fixed_function(const std::vector<Sprite> &sprites)
+    {
+        const size_t count = sprites.size();
+        const size_t per_body = CIRCLE_SEGMENTS + 2;
+        fan_vertices.resize(count * per_body * 2);
+        fan_colors.resize(count * per_body * 3);
+
+#pragma omp parallel for
+        for (size_t i = 0; i < count; ++i)
+        {
+            float *v = &fan_vertices[i * per_body * 2];
+            float *c = &fan_colors[i * per_body * 3];
+            const Sprite &s = sprites[i];
+
+            v[0] = s.x;
+            v[1] = s.y;
+            for (int k = 0; k <= CIRCLE_SEGMENTS; ++k)
+            {
+                v[2 * (k + 1)] = s.x + s.radius * circle_x[k];
+                v[2 * (k + 1) + 1] = s.y + s.radius * circle_y[k];
+            }
+            for (size_t k = 0; k < per_body; ++k)
+            {
+                c[3 * k] = s.r;
+                c[3 * k + 1] = s.g;
+                c[3 * k + 2] = s.b;
+            }
+        }
+
+        // Indices only depend on the body count
+        if (fan_indices.size() != count * CIRCLE_SEGMENTS * 3)
+        {
+            fan_indices.resize(count * CIRCLE_SEGMENTS * 3);
+#pragma omp parallel for
+            for (size_t i = 0; i < count; ++i)
+            {
+                const GLuint base = static_cast<GLuint>(i * per_body);
+                GLuint *idx = &fan_indices[i * CIRCLE_SEGMENTS * 3];
+                for (int k = 0; k < CIRCLE_SEGMENTS; ++k)
+                {
+                    idx[3 * k] = base;
+                    idx[3 * k + 1] = base + 1 + k;
+                    idx[3 * k + 2] = base + 2 + k;
+                }
+            }
+        }
+
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, 0, fan_vertices.data());
+        glColorPointer(3, GL_FLOAT, 0, fan_colors.data());
+        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(fan_indices.size()), GL_UNSIGNED_INT, fan_indices.data());
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+};
+
+#endif
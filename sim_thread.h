@@ -0,0 +1,144 @@
+#ifndef SIM_THREAD_H
+#define SIM_THREAD_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
+#include <cstdint>
+#include "simulation.h"
+#include "snapshot.h"
+#include "triple_buffer.h"
+
+// Messages from the UI thread to the simulation thread
+enum class SimCommand
+{
+    TogglePause,
+    MoreSteps, // Double the steps per rendered frame
+    FewerSteps,
+    Quit
+};
+
+// Runs a Simulation on its own thread. Every steps_per_frame steps it
+// publishes a Snapshot through a lock-free triple buffer, so rendering
+// never waits on a step and vsync never stalls the simulation. The thread
+// stays at most one batch ahead of the frames the renderer asked for.
+class SimulationThread
+{
+public:
+    SimulationThread(Simulation &sim, int steps_per_frame)
+        : sim(sim),
+          steps_per_frame(std::max(1, steps_per_frame))
+    {
+        // The first frame shows the initial state
+        snapshots.back().capture(sim.soa, sim.frame);
+        snapshots.publish();
+    }
+
+    ~SimulationThread()
+    {
+        stop();
+    }
+
+    void start()
+    {
+        if (!worker.joinable())
+            worker = std::thread(&SimulationThread::run, this);
+    }
+
+    void stop()
+    {
+        if (!worker.joinable())
+            return;
+        send(SimCommand::Quit);
+        worker.join();
+    }
+
+    void send(SimCommand command)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            commands.push_back(command);
+        }
+        wake.notify_one();
+    }
+
+    // Called by the renderer once per drawn frame
+    void request_frame()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            frames_requested = std::min(frames_requested + 1, batches + 1);
+        }
+        wake.notify_one();
+    }
+
+    // Latest published frame, stable until the next call
+    const Snapshot &latest()
+    {
+        return snapshots.front();
+    }
+
+private:
+    Simulation &sim;
+    TripleBuffer<Snapshot> snapshots;
+    std::thread worker;
+
+    // Guarded by mutex
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<SimCommand> commands;
+    uint64_t frames_requested = 0;
+    uint64_t batches = 0;
+
+    // Owned by the simulation thread
+    bool paused = true;
+    int steps_per_frame;
+
+    void run()
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]
+                          { return !commands.empty() || (!paused && batches <= frames_requested); });
+
+                while (!commands.empty())
+                {
+                    const SimCommand command = commands.front();
+                    commands.pop_front();
+                    switch (command)
+                    {
+                    case SimCommand::TogglePause:
+                        paused = !paused;
+                        break;
+                    case SimCommand::MoreSteps:
+                        steps_per_frame = std::min(steps_per_frame * 2, 1024);
+                        break;
+                    case SimCommand::FewerSteps:
+                        steps_per_frame = std::max(steps_per_frame / 2, 1);
+                        break;
+                    case SimCommand::Quit:
+                        return;
+                    }
+                }
+
+                if (paused || batches > frames_requested)
+                    continue;
+            }
+
+            for (int i = 0; i < steps_per_frame; ++i)
+                sim.step();
+
+            snapshots.back().capture(sim.soa, sim.frame);
+            snapshots.publish();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            ++batches;
+        }
+    }
+};
+
+#endif
@@ -12,12 +12,44 @@
 #include <glm/gtx/norm.hpp>
 
 #include "body.h"
+#include "body_soa.h"
 #include "quadtree.h"
+#include "fmm.h"
+#include "direct.h"
+#include "union_find.h"
+#include "trajectory.h"
+#include "stats.h"
 
 const float THETA = 1.5;
 const float EPSILON = 1.0;
+// Opening angle of the tree Simulation::energy() sums the potential on
+const float ENERGY_THETA = 0.5;
 extern const bool COLLISION;
 
+enum class CurveOrder
+{
+    Morton,
+    Hilbert
+};
+
+enum class ForceMethod
+{
+    BarnesHut,  // Monopole tree walk, acc() or acc_groups()
+    Quadrupole, // Tree walk with quadrupole corrections
+    Multipole   // Dual-tree FMM with local expansions
+};
+
+enum class Integrator
+{
+    Euler,    // Semi-implicit Euler as in Body::update()
+    Leapfrog, // Kick-drift-kick, one force evaluation per step
+    Yoshida4  // Three leapfrog steps with Yoshida's fourth-order weights
+};
+
+// Yoshida's weights for a fourth-order composition of leapfrog steps
+const double YOSHIDA_W1 = 1.0 / (2.0 - std::cbrt(2.0));
+const double YOSHIDA_W0 = -std::cbrt(2.0) / (2.0 - std::cbrt(2.0));
+
 class Simulation
 {
 
@@ -25,214 +57,686 @@ public:
     int n;
     int frame;
     float dt;
+    float theta;
+    float epsilon;
+    bool collision;
+    bool parallel_build = true;
+    // Vectorized group walk instead of one scalar walk per body (needs parallel_build)
+    bool group_walk = true;
+    // Exact direct summation instead of a tree below this many bodies
+    size_t direct_crossover = DIRECT_CROSSOVER;
+    ForceMethod force_method = ForceMethod::BarnesHut;
+    Integrator integrator = Integrator::Euler;
+    // soa.ax/ay hold the forces at the current positions, so the next
+    // leapfrog step can reuse the last evaluation of the previous one
+    bool forces_valid = false;
+
+    // Relative energy drift |E - E0| / |E0| sampled every energy_interval
+    // steps (0 disables). Collisions are inelastic and show up as drift. E0
+    // is taken on the first step after construction, restart() or a
+    // checkpoint restore, which clear has_initial_energy. The potential is
+    // summed on energy_tree, never on the force tree qt.
+    int energy_interval = 0;
+    bool has_initial_energy = false;
+    double initial_energy = 0.0;
+    double energy_drift = 0.0;
+    double max_energy_drift = 0.0;
+
+    // Positions streamed to a file every trajectory.interval steps once
+    // trajectory.open() succeeds
+    TrajectoryWriter trajectory;
+
+    // Per-phase timings, tree shape and collision counts of recent steps,
+    // recorded while stats.enabled is set
+    StatsRecorder stats;
+
+    // Refit last frame's tree instead of rebuilding it when the bodies allow.
+    // The root cell is padded by tree_margin so bodies can drift outward.
+    bool incremental_tree = false;
+    float tree_margin = 0.05f;
+
+    // Block time steps: each body advances with dt / 2^level, level chosen
+    // from timestep_accuracy * min(|v| / |a|, sqrt(epsilon / |a|)) and capped
+    // at max_timestep_level (0 gives every body the global dt). Yoshida4 uses
+    // the leapfrog kicks inside blocks.
+    int max_timestep_level = 0;
+    float timestep_accuracy = 0.25f;
+    std::vector<uint8_t> step_level;
+    // Bodies whose force attract() evaluates, empty when all of them
+    std::vector<uint8_t> active;
+    size_t force_evaluations = 0;
+
+    // Caller-owned AoS view, refreshed from soa by sync()
     std::vector<Body> &bodies;
-    Quadtree qt = Quadtree(THETA, EPSILON);
-    Simulation(int n, float dt, std::vector<Body> &b) : n(n), dt(dt), frame(0), bodies(b) {};
+    // Physics state the simulation actually runs on
+    BodySoA soa;
+    BodySoA scratch;
+    Quadtree qt;
+    Quadtree energy_tree;
+    DirectSummation direct;
+    FastMultipole fmm;
+
+    // Reorder bodies along a space-filling curve every reorder_interval
+    // steps so neighbouring iterations walk similar tree paths (0 disables)
+    int reorder_interval = 0;
+    CurveOrder reorder_curve = CurveOrder::Hilbert;
+    std::vector<uint32_t> sfc_keys, sfc_order, sfc_keys_tmp, sfc_order_tmp;
+
+    // Collision broadphase on the force tree, else on a uniform grid with
+    // cell lists reused across frames
+    bool tree_collisions = true;
+    std::vector<uint32_t> cell_of, cell_start, cell_order, cell_hist;
+    std::vector<float> cell_x, cell_y, cell_r;
+    // Merge phase scratch, reused across frames
+    ConcurrentDisjointSets sets;
+    std::vector<uint8_t> merge_keep;
+    std::vector<uint32_t> merge_offset, merge_root, merge_body, merge_root_tmp, merge_body_tmp, merge_partial;
+    std::vector<size_t> compact_counts;
+    // Per-thread digit counts for the radix sorts of reorder() and collide()
+    std::vector<size_t> sort_hist;
+    // Cost-balanced ranges of the scalar force loop, see Quadtree::balance_by_cost
+    CostPartition force_partition;
+
+    // Body::id -> index into soa, rebuilt lazily after reordering
+    std::vector<size_t> slots;
+    bool slots_dirty = true;
+    static constexpr size_t NO_SLOT = std::numeric_limits<size_t>::max();
+
+    Simulation(int n, float dt, std::vector<Body> &b) : Simulation(n, dt, b, THETA, EPSILON, COLLISION) {};
+
+    // Runtime-configured variant used by the headless driver
+    Simulation(int n, float dt, std::vector<Body> &b, float theta, float epsilon, bool collision)
+        : n(n),
+          frame(0),
+          dt(dt),
+          theta(theta),
+          epsilon(epsilon),
+          collision(collision),
+          bodies(b),
+          qt(theta, epsilon),
+          energy_tree(ENERGY_THETA, epsilon)
+    {
+        soa.load(bodies);
+    };
+
+    // Start a new run from the caller's bodies with the same settings. Every
+    // scratch buffer keeps its capacity, so back-to-back runs of similar
+    // size stop allocating after the first.
+    void restart()
+    {
+        n = static_cast<int>(bodies.size());
+        frame = 0;
+        forces_valid = false;
+        has_initial_energy = false;
+        initial_energy = 0.0;
+        energy_drift = 0.0;
+        max_energy_drift = 0.0;
+        force_evaluations = 0;
+        step_level.clear();
+        active.clear();
+        slots_dirty = true;
+        qt.leaf_of.clear();
+        qt.refittable = false;
+        soa.load(bodies);
+    }
 
     void step()
     {
-        attract();
-        if (COLLISION)
-            collide();
-        iterate();
+        if (energy_interval > 0 && !has_initial_energy)
+        {
+            initial_energy = energy();
+            has_initial_energy = true;
+        }
+
+        begin_stats();
+
+        if (reorder_interval > 0 && frame % reorder_interval == 0)
+        {
+            PhaseTimer timer(stats, PHASE_REORDER);
+            reorder();
+        }
+
+        if (max_timestep_level > 0)
+        {
+            block_step();
+            if (collision)
+                collide();
+        }
+        else if (integrator == Integrator::Euler)
+        {
+            evaluate_forces();
+            if (collision)
+                collide();
+            iterate();
+        }
+        else
+        {
+            if (integrator == Integrator::Leapfrog)
+            {
+                kick_drift_kick(dt);
+            }
+            else
+            {
+                kick_drift_kick(static_cast<float>(YOSHIDA_W1 * dt));
+                kick_drift_kick(static_cast<float>(YOSHIDA_W0 * dt));
+                kick_drift_kick(static_cast<float>(YOSHIDA_W1 * dt));
+            }
+            if (collision)
+                collide();
+        }
         frame += 1;
+
+        if (trajectory.is_open() && trajectory.interval > 0 && frame % trajectory.interval == 0)
+            trajectory.record(soa, frame);
+
+        end_stats();
+
+        if (energy_interval > 0 && frame % energy_interval == 0)
+        {
+            energy_drift = initial_energy != 0.0 ? std::abs(energy() - initial_energy) / std::abs(initial_energy) : 0.0;
+            max_energy_drift = std::max(max_energy_drift, energy_drift);
+        }
     }
 
-    void iterate()
+    void begin_stats()
+    {
+#if NBODY_STATS
+        stats.begin(frame);
+        qt.count_walks = stats.enabled;
+        if (stats.enabled)
+            qt.reset_walk_counters();
+#endif
+    }
+
+    void end_stats()
     {
-        for (auto &b : bodies)
+#if NBODY_STATS
+        if (!stats.enabled)
+            return;
+
+        StepStats &s = stats.current;
+        s.bodies = soa.size();
+        s.tree_nodes = qt.nodes.size();
+        s.tree_leaves = qt.leaf_count();
+        s.tree_depth = qt.max_depth;
+        for (const Quadtree::WalkCounter &c : qt.walk_counters)
         {
-            b.update(dt);
+            s.walks += c.walks;
+            s.walk_visits += c.visits;
+            s.max_walk_visits = std::max(s.max_walk_visits, c.max_visits);
         }
+        qt.count_walks = false;
+        stats.end();
+#endif
     }
 
-    void attract()
+    // Copy the current state back into the caller's std::vector<Body>
+    void sync()
     {
-        Quad q = new_quadtree(bodies);
-        qt.clear(q);
+        soa.store(bodies);
+    }
 
-        for (const auto &b : bodies)
+    // Index of the body with the given ID, or NO_SLOT if it merged away
+    size_t index_of(uint32_t id)
+    {
+        if (slots_dirty)
         {
-            qt.insert(b.position, b.mass);
+            uint32_t max_id = 0;
+            for (const uint32_t b : soa.id)
+                max_id = std::max(max_id, b);
+
+            slots.assign(static_cast<size_t>(max_id) + 1, NO_SLOT);
+            for (size_t i = 0; i < soa.size(); ++i)
+                slots[soa.id[i]] = i;
+            slots_dirty = false;
         }
+        return id < slots.size() ? slots[id] : NO_SLOT;
+    }
 
-        qt.propagate();
+    void reorder()
+    {
+        const size_t count = soa.size();
+        if (count <= 1)
+            return;
+
+        const Quad q = new_quadtree(soa);
+        const glm::vec2 min = q.center - glm::vec2(q.size * 0.5f);
+        const float inv_cell = q.size > 0.0f ? MORTON_CELLS / q.size : 0.0f;
+        const bool hilbert = reorder_curve == CurveOrder::Hilbert;
 
+        sfc_keys.resize(count);
+        sfc_order.resize(count);
 #pragma omp parallel for
-        for (auto &b : bodies)
+        for (size_t i = 0; i < count; ++i)
         {
-            b.acceleration = qt.acc(b.position);
+            const glm::vec2 pos = soa.position(i);
+            sfc_keys[i] = hilbert ? hilbert_key(pos, min, inv_cell) : morton_key(pos, min, inv_cell);
+            sfc_order[i] = static_cast<uint32_t>(i);
         }
+        radix_sort_pairs(sfc_keys, sfc_order, sfc_keys_tmp, sfc_order_tmp, sort_hist);
+
+        scratch.gather(soa, sfc_order);
+        soa.swap(scratch);
+        slots_dirty = true;
+        qt.refittable = false;
     }
 
-    void collide()
+    void iterate()
     {
-        if (bodies.size() <= 1)
-            return;
+        PhaseTimer timer(stats, PHASE_INTEGRATE);
+        soa.update(dt);
+        forces_valid = false;
+    }
 
-        // Initialize disjoint-set arrays for union-find
-        std::vector<size_t> parent(bodies.size());
-        std::vector<size_t> rank(bodies.size(), 0);
-        for (size_t i = 0; i < bodies.size(); ++i)
-            parent[i] = i;
-
-        // Find function with path compression
-        std::function<size_t(size_t)> find = [&](size_t x) -> size_t
-        {
-            if (parent[x] != x)
-                parent[x] = find(parent[x]);
-            return parent[x];
-        };
-
-        // Union function using rank for balance
-        auto unite = [&](size_t x, size_t y)
-        {
-            x = find(x);
-            y = find(y);
-            if (x == y)
-                return;
-            if (rank[x] < rank[y])
-                parent[x] = y;
-            else
+    void evaluate_forces()
+    {
+        attract();
+        force_evaluations += soa.size();
+        forces_valid = true;
+    }
+
+    // Leapfrog step of length h, the closing force evaluation doubles as
+    // the opening one of the next step
+    void kick_drift_kick(float h)
+    {
+        if (!forces_valid)
+            evaluate_forces();
+
+        {
+            PhaseTimer timer(stats, PHASE_INTEGRATE);
+            soa.kick(0.5f * h);
+            soa.drift(h);
+        }
+        evaluate_forces();
+        PhaseTimer timer(stats, PHASE_INTEGRATE);
+        soa.kick(0.5f * h);
+    }
+
+    // One global dt as 2^max_timestep_level substeps. Every substep drifts
+    // all bodies, so the tree always sees current positions, but only the
+    // bodies finishing a block get a force evaluation. Each block kicks
+    // with its opening share at the start and the rest at the end.
+    void block_step()
+    {
+        const size_t count = soa.size();
+        const uint32_t substeps = 1u << max_timestep_level;
+        const float dt_min = dt / static_cast<float>(substeps);
+        const float open = integrator == Integrator::Euler ? 1.0f : 0.5f;
+        step_level.resize(count);
+        active.resize(count);
+
+        if (!forces_valid)
+            evaluate_forces();
+
+        for (uint32_t s = 0; s < substeps; ++s)
+        {
+            size_t active_count = 0;
             {
-                parent[y] = x;
-                if (rank[x] == rank[y])
-                    rank[x]++;
+                PhaseTimer timer(stats, PHASE_INTEGRATE);
+#pragma omp parallel for
+                for (size_t i = 0; i < count; ++i)
+                {
+                    if (s % (substeps >> step_level[i]) == 0)
+                    {
+                        step_level[i] = static_cast<uint8_t>(timestep_level(i, s));
+                        const float h = open * dt / static_cast<float>(1u << step_level[i]);
+                        soa.vx[i] += soa.ax[i] * h;
+                        soa.vy[i] += soa.ay[i] * h;
+                    }
+                    soa.x[i] += soa.vx[i] * dt_min;
+                    soa.y[i] += soa.vy[i] * dt_min;
+                }
+
+#pragma omp parallel for reduction(+ : active_count)
+                for (size_t i = 0; i < count; ++i)
+                {
+                    active[i] = (s + 1) % (substeps >> step_level[i]) == 0;
+                    active_count += active[i];
+                }
             }
-        };
+            if (active_count == 0)
+                continue;
 
-        // Create spatial grid
-        Quad q = new_quadtree(bodies);
+            attract();
+            force_evaluations += active_count;
 
-        // Determine grid cell size based on maximum body radius
-        float max_radius = 0.0f;
-        for (const auto &body : bodies)
-            max_radius = std::max(max_radius, body.radius);
+            if (open < 1.0f)
+            {
+                PhaseTimer timer(stats, PHASE_INTEGRATE);
+#pragma omp parallel for
+                for (size_t i = 0; i < count; ++i)
+                {
+                    if (!active[i])
+                        continue;
+                    const float h = (1.0f - open) * dt / static_cast<float>(1u << step_level[i]);
+                    soa.vx[i] += soa.ax[i] * h;
+                    soa.vy[i] += soa.ay[i] * h;
+                }
+            }
+        }
 
-        float grid_cell_size = std::max(max_radius * 4.0f, q.size / 50.0f);
-        int grid_width = static_cast<int>(std::ceil(q.size / grid_cell_size));
-        int grid_height = grid_width;
-        grid_cell_size = q.size / static_cast<float>(grid_width);
+        active.clear();
+        forces_valid = true;
+    }
+
+    // Kinetic plus potential energy. Below direct_crossover bodies the
+    // potential is summed over every pair, else walked on energy_tree at
+    // ENERGY_THETA: at the force theta the tree's own error is many times
+    // the integrator's drift. Bodies of at least 1% of the total mass, the
+    // sun, sum theirs directly; their weight would scale up the walk's
+    // error. qt and its refit state are left alone. One call costs about a
+    // dozen force evaluations at 200k bodies.
+    double energy()
+    {
+        double kinetic = 0.0;
+#pragma omp parallel for reduction(+ : kinetic)
+        for (size_t i = 0; i < soa.size(); ++i)
+        {
+            const double m = soa.mass[i];
+            kinetic += 0.5 * m * (soa.vx[i] * soa.vx[i] + soa.vy[i] * soa.vy[i]);
+        }
 
-        // Create grid structure (each cell will store indices of bodies)
-        std::vector<std::vector<size_t>> grid(grid_width * grid_height);
+        if (soa.size() < direct_crossover)
+            return kinetic + DirectSummation::potential(soa, epsilon);
 
-        // Lambda to map position to grid cell coordinates
-        auto pos_to_cell = [&](const glm::vec2 &pos) -> std::pair<int, int>
+        energy_tree.build(soa, new_quadtree(soa));
+        energy_tree.propagate_levels();
+        const float heavy = 0.01f * energy_tree.nodes[Quadtree::ROOT].mass;
+        double potential = 0.0;
+#pragma omp parallel for schedule(dynamic, 256) reduction(+ : potential)
+        for (size_t i = 0; i < soa.size(); ++i)
         {
-            float min_x = q.center.x - q.size / 2.0f;
-            float min_y = q.center.y - q.size / 2.0f;
-            int x = static_cast<int>((pos.x - min_x) / grid_cell_size);
-            int y = static_cast<int>((pos.y - min_y) / grid_cell_size);
-            x = std::max(0, std::min(x, grid_width - 1));
-            y = std::max(0, std::min(y, grid_height - 1));
-            return {x, y};
-        };
+            if (soa.mass[i] < heavy)
+                potential += 0.5 * soa.mass[i] * energy_tree.potential(soa.position(i));
+        }
+        for (size_t i = 0; i < soa.size(); ++i)
+        {
+            if (soa.mass[i] >= heavy)
+                potential += 0.5 * soa.mass[i] * DirectSummation::potential_at(soa, i, epsilon);
+        }
+        return kinetic + potential;
+    }
 
-        // --- Step 1: Compute grid cell for each body in parallel ---
-        // We store the cell index for each body.
-        std::vector<int> cellIndex(bodies.size());
-#pragma omp parallel for
-        for (size_t i = 0; i < bodies.size(); ++i)
+    // Level for body i starting a block at substep s. A body may only move
+    // to a coarser level whose blocks also start at s.
+    int timestep_level(size_t i, uint32_t s) const
+    {
+        const uint32_t substeps = 1u << max_timestep_level;
+        const float a = std::sqrt(soa.ax[i] * soa.ax[i] + soa.ay[i] * soa.ay[i]);
+        const float v = std::sqrt(soa.vx[i] * soa.vx[i] + soa.vy[i] * soa.vy[i]);
+
+        int level = 0;
+        if (a > 0.0f)
         {
-            auto cell = pos_to_cell(bodies[i].position);
-            cellIndex[i] = cell.second * grid_width + cell.first;
+            const float ideal = timestep_accuracy * std::min(v / a, std::sqrt(epsilon / a));
+            for (float h = dt; level < max_timestep_level && h > ideal; h *= 0.5f)
+                ++level;
         }
 
-        // Insert bodies into the grid (done sequentially to avoid data races)
-        for (size_t i = 0; i < bodies.size(); ++i)
+        while (s % (substeps >> level) != 0)
+            ++level;
+        return level;
+    }
+
+    // Accelerations for every body, or only the flagged ones during block_step()
+    void attract()
+    {
+        if (soa.size() < direct_crossover)
         {
-            grid[cellIndex[i]].push_back(i);
+            PhaseTimer timer(stats, PHASE_FORCE);
+            direct.evaluate(soa, epsilon * epsilon, active);
+            // Without a tree this step collide() uses the grid and refits rebuild
+            qt.leaf_of.clear();
+            qt.refittable = false;
+            return;
         }
 
-        // --- Step 2: Collision detection ---
-        // Accumulate collision pairs in parallel.
-        std::vector<std::pair<size_t, size_t>> collisionPairs;
-#pragma omp parallel
+        // The multipole engine, refits, leaf buckets and the tree broadphase
+        // need the leaf lookup only build() records
+        const bool use_build = parallel_build || incremental_tree || force_method == ForceMethod::Multipole ||
+                               qt.bucketed() || (collision && tree_collisions);
+
+        // A successful refit already updated the centers of mass
+        bool refitted = false;
+        if (incremental_tree)
+        {
+            PhaseTimer timer(stats, PHASE_INSERT);
+            refitted = qt.refit(soa);
+        }
+
+        if (!refitted)
         {
-            std::vector<std::pair<size_t, size_t>> localPairs;
-#pragma omp for nowait
-            for (size_t i = 0; i < bodies.size(); ++i)
+            PhaseTimer timer(stats, PHASE_BBOX);
+            Quad q = new_quadtree(soa);
+            timer.next(PHASE_INSERT);
+
+            if (use_build)
+            {
+                if (incremental_tree)
+                    q.size *= 1.0f + tree_margin;
+                qt.build(soa, q);
+                timer.next(PHASE_PROPAGATE);
+                qt.propagate_levels();
+            }
+            else
             {
-                auto cell = pos_to_cell(bodies[i].position);
-                int x1 = cell.first;
-                int y1 = cell.second;
-                for (int dy = -1; dy <= 1; ++dy)
+                qt.clear(q);
+
+                for (size_t i = 0; i < soa.size(); ++i)
                 {
-                    for (int dx = -1; dx <= 1; ++dx)
-                    {
-                        int nx = x1 + dx;
-                        int ny = y1 + dy;
-                        if (nx < 0 || nx >= grid_width || ny < 0 || ny >= grid_height)
-                            continue;
-                        const auto &cellBodies = grid[ny * grid_width + nx];
-                        for (size_t j : cellBodies)
-                        {
-                            if (i >= j)
-                                continue; // ensure each pair is checked once
-                            const Body &b1 = bodies[i];
-                            const Body &b2 = bodies[j];
-                            glm::vec2 diff = b1.position - b2.position;
-                            float distance_squared = glm::dot(diff, diff);
-                            float merge_threshold = (b1.radius + b2.radius) * (b1.radius + b2.radius);
-                            if (distance_squared <= merge_threshold)
-                            {
-                                localPairs.emplace_back(i, j);
-                            }
-                        }
-                    }
+                    qt.insert(soa.position(i), soa.mass[i]);
                 }
+
+                timer.next(PHASE_PROPAGATE);
+                qt.propagate();
             }
-            // Merge thread-local pairs into the global vector.
-#pragma omp critical
+        }
+
+        if (force_method != ForceMethod::BarnesHut)
+        {
+            PhaseTimer timer(stats, PHASE_PROPAGATE);
+            qt.propagate_moments();
+        }
+
+        PhaseTimer timer(stats, PHASE_FORCE);
+
+        if (force_method == ForceMethod::Multipole)
+        {
+            fmm.evaluate(qt, soa, active);
+            return;
+        }
+
+        if (force_method == ForceMethod::BarnesHut && use_build && group_walk)
+        {
+            qt.acc_groups(soa, active);
+            return;
+        }
+
+        // Bodies in dense regions walk far more of the tree; split the loop
+        // by the work each body's walk took last time
+        const bool quadrupole = force_method == ForceMethod::Quadrupole;
+        force_partition.split(soa.size(), [&](size_t i)
+                              { return active.empty() || active[i] ? qt.body_cost(soa, static_cast<uint32_t>(i)) : 0; });
+#pragma omp parallel for schedule(dynamic, 1)
+        for (size_t p = 0; p < force_partition.parts(); ++p)
+        {
+            for (size_t i = force_partition.bounds[p]; i < force_partition.bounds[p + 1]; ++i)
             {
-                collisionPairs.insert(collisionPairs.end(), localPairs.begin(), localPairs.end());
+                if (!active.empty() && !active[i])
+                    continue;
+                const glm::vec2 pos = soa.position(i);
+                const glm::vec2 a = quadrupole ? qt.acc_quadrupole(pos, &soa.cost[i]) : qt.acc(pos, &soa.cost[i]);
+                soa.ax[i] = a.x;
+                soa.ay[i] = a.y;
             }
         }
+    }
+
+    void collide()
+    {
+        const size_t count = soa.size();
+        if (count <= 1)
+            return;
+
+        // --- Step 1: Unite every pair of touching bodies ---
+        PhaseTimer timer(stats, PHASE_BROADPHASE);
+        sets.reset(count);
+        const bool tree_ready = tree_collisions && qt.leaf_of.size() == count;
+        const size_t pair_count = tree_ready ? tree_pairs() : grid_pairs();
+        stats.current.collision_pairs += pair_count;
+
+        if (pair_count == 0)
+            return;
+        timer.next(PHASE_UNION_FIND);
 
-        // Process union-find sequentially over the collision pairs.
-        for (const auto &pair : collisionPairs)
+        // --- Step 2: Group merged bodies by their set root ---
+        // Roots are the smallest index of each set. The other members are
+        // listed in index order, then stably sorted by root into runs.
+        merge_keep.resize(count);
+        merge_offset.resize(count);
+#pragma omp parallel for
+        for (size_t i = 0; i < count; ++i)
         {
-            unite(pair.first, pair.second);
+            merge_keep[i] = sets.is_root(static_cast<uint32_t>(i));
+            merge_offset[i] = !merge_keep[i];
         }
+        const uint32_t merged = parallel_exclusive_scan(merge_offset, merge_partial);
 
-        // --- Step 3: Group bodies by their set representative ---
-        std::unordered_map<size_t, std::vector<size_t>> groups;
-        for (size_t i = 0; i < bodies.size(); ++i)
+        merge_root.resize(merged);
+        merge_body.resize(merged);
+#pragma omp parallel for
+        for (size_t i = 0; i < count; ++i)
         {
-            groups[find(i)].push_back(i);
+            if (merge_keep[i])
+                continue;
+            merge_root[merge_offset[i]] = sets.find(static_cast<uint32_t>(i));
+            merge_body[merge_offset[i]] = static_cast<uint32_t>(i);
         }
+        radix_sort_pairs(merge_root, merge_body, merge_root_tmp, merge_body_tmp, sort_hist);
+        stats.current.merged_bodies += merged;
+        timer.next(PHASE_MERGE);
 
-        // --- Step 4: Merge groups into new bodies ---
-        std::vector<Body> new_bodies;
-        new_bodies.reserve(groups.size());
-        for (const auto &group : groups)
+        // --- Step 3: Merge each run into its root, runs in parallel ---
+#pragma omp parallel for schedule(dynamic, 64)
+        for (size_t k = 0; k < merged; ++k)
         {
-            const std::vector<size_t> &indices = group.second;
-            if (indices.size() == 1)
+            if (k > 0 && merge_root[k] == merge_root[k - 1])
+                continue;
+            for (size_t j = k; j < merged && merge_root[j] == merge_root[k]; ++j)
             {
-                new_bodies.push_back(bodies[indices[0]]);
+                merge_bodies(soa, merge_root[k], merge_body[j]);
             }
-            else
+        }
+
+        // --- Step 4: Drop merged bodies in place, keeping the order ---
+        soa.compact(merge_keep, compact_counts);
+        slots_dirty = true;
+        qt.refittable = false;
+        // Merged bodies lost their accelerations
+        forces_valid = false;
+    }
+
+    // Broadphase on the tree from attract(). Node bounds come from the
+    // current positions, so bodies that drifted since are still found.
+    size_t tree_pairs()
+    {
+        qt.propagate_bounds(soa);
+        return qt.collision_pairs(soa, [&](uint32_t i, uint32_t j)
+                                  { sets.unite(i, j); });
+    }
+
+    // Broadphase on a uniform grid with CSR cell lists
+    size_t grid_pairs()
+    {
+        // Create spatial grid
+        Quad q = new_quadtree(soa);
+
+        const size_t count = soa.size();
+
+        // Determine grid cell size based on maximum body radius
+        float max_radius = 0.0f;
+#pragma omp parallel for reduction(max : max_radius)
+        for (size_t i = 0; i < count; ++i)
+            max_radius = std::max(max_radius, soa.radius[i]);
+
+        float grid_cell_size = std::max(max_radius * 4.0f, q.size / 50.0f);
+        const int grid_width = std::max(1, static_cast<int>(std::ceil(q.size / grid_cell_size)));
+        const int grid_height = grid_width;
+        grid_cell_size = q.size / static_cast<float>(grid_width);
+        const float inv_cell = grid_cell_size > 0.0f ? 1.0f / grid_cell_size : 0.0f;
+        const glm::vec2 min = q.center - glm::vec2(q.size * 0.5f);
+
+        // Cell per body in parallel, then a counting sort by cell: the
+        // bodies of cell c are cell_order[cell_start[c] .. cell_start[c + 1])
+        cell_of.resize(count);
+#pragma omp parallel for
+        for (size_t i = 0; i < count; ++i)
+        {
+            const int x = std::clamp(static_cast<int>((soa.x[i] - min.x) * inv_cell), 0, grid_width - 1);
+            const int y = std::clamp(static_cast<int>((soa.y[i] - min.y) * inv_cell), 0, grid_height - 1);
+            cell_of[i] = static_cast<uint32_t>(y * grid_width + x);
+        }
+        counting_sort(cell_of, static_cast<size_t>(grid_width) * grid_height, cell_start, cell_order, cell_hist);
+
+        // Copy what the scan reads into cell order so neighbours are contiguous
+        cell_x.resize(count);
+        cell_y.resize(count);
+        cell_r.resize(count);
+#pragma omp parallel for
+        for (size_t k = 0; k < count; ++k)
+        {
+            const uint32_t i = cell_order[k];
+            cell_x[k] = soa.x[i];
+            cell_y[k] = soa.y[i];
+            cell_r[k] = soa.radius[i];
+        }
+
+        // Each cell checks itself and its forward half of the 3x3
+        // neighbourhood, so every pair is tested once. Colliding pairs are
+        // united straight away in the lock-free disjoint sets.
+        static constexpr int FORWARD[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+        size_t pair_count = 0;
+
+#pragma omp parallel for schedule(dynamic, 16) reduction(+ : pair_count)
+        for (int c = 0; c < grid_width * grid_height; ++c)
+        {
+            const uint32_t begin = cell_start[c];
+            const uint32_t end = cell_start[c + 1];
+            if (begin == end)
+                continue;
+
+            auto test = [&](uint32_t a, uint32_t b)
             {
-                // Optionally, the merge operations for different groups can be done in parallel.
-                Body merged = bodies[indices[0]];
-                for (size_t i = 1; i < indices.size(); ++i)
+                const float dx = cell_x[a] - cell_x[b];
+                const float dy = cell_y[a] - cell_y[b];
+                const float radius_sum = cell_r[a] + cell_r[b];
+                if (dx * dx + dy * dy <= radius_sum * radius_sum)
                 {
-                    merged = merge_bodies(merged, bodies[indices[i]]);
+                    sets.unite(cell_order[a], cell_order[b]);
+                    ++pair_count;
                 }
-                new_bodies.push_back(merged);
+            };
+
+            for (uint32_t a = begin; a < end; ++a)
+                for (uint32_t b = a + 1; b < end; ++b)
+                    test(a, b);
+
+            const int x = c % grid_width;
+            const int y = c / grid_width;
+            for (const auto &f : FORWARD)
+            {
+                const int nx = x + f[0];
+                const int ny = y + f[1];
+                if (nx < 0 || nx >= grid_width || ny >= grid_height)
+                    continue;
+                const int n = ny * grid_width + nx;
+                for (uint32_t a = begin; a < end; ++a)
+                    for (uint32_t b = cell_start[n]; b < cell_start[n + 1]; ++b)
+                        test(a, b);
             }
         }
 
-        // Replace old bodies with the new ones
-        bodies = std::move(new_bodies);
-
-        std::sort(bodies.begin(), bodies.end(),
-                  [](const Body &a, const Body &b)
-                  {
-                      return glm::length2(a.position) < glm::length2(b.position);
-                  });
+        return pair_count;
     }
 };
 
@@ -0,0 +1,36 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "body_soa.h"
+
+// Packed per-body vertex, uploaded once per frame
+struct Sprite
+{
+    float x, y;
+    float radius;
+    float r, g, b;
+};
+
+// Immutable view of one simulation frame handed from the simulation
+// thread to the renderer
+struct Snapshot
+{
+    std::vector<Sprite> sprites;
+    int frame = 0;
+
+    void capture(const BodySoA &bodies, int sim_frame)
+    {
+        sprites.resize(bodies.size());
+#pragma omp parallel for
+        for (size_t i = 0; i < bodies.size(); ++i)
+        {
+            const glm::vec3 &c = bodies.color[i];
+            sprites[i] = Sprite{bodies.x[i], bodies.y[i], bodies.radius[i], c.r, c.g, c.b};
+        }
+        frame = sim_frame;
+    }
+};
+
+#endif
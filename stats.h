@@ -0,0 +1,344 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <ostream>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+// Build with -DNBODY_STATS=0 to compile the timers and walk counters out;
+// StatsRecorder then records nothing but keeps its API.
+#ifndef NBODY_STATS
+#define NBODY_STATS 1
+#endif
+
+// StepStats::allocations needs a counting operator new, which only the
+// executable can install: it defines NBODY_COUNT_ALLOCATIONS to 1 before
+// including this header and defines heap_allocations and the replacement
+// itself (see headless.cpp). Without it allocations stay zero.
+#ifndef NBODY_COUNT_ALLOCATIONS
+#define NBODY_COUNT_ALLOCATIONS 0
+#endif
+
+#if NBODY_COUNT_ALLOCATIONS
+// operator new calls made by the current thread
+extern thread_local uint64_t heap_allocations;
+#endif
+
+// Allocations so far by the calling thread and its OpenMP team, so other
+// simulations, render and writer threads do not count
+inline uint64_t team_allocations()
+{
+    uint64_t total = 0;
+#if NBODY_COUNT_ALLOCATIONS
+#pragma omp parallel reduction(+ : total)
+    total += heap_allocations;
+#endif
+    return total;
+}
+
+enum Phase
+{
+    PHASE_BBOX,
+    PHASE_INSERT, // Tree build or refit
+    PHASE_PROPAGATE,
+    PHASE_FORCE,
+    PHASE_BROADPHASE,
+    PHASE_UNION_FIND, // Grouping united bodies by set root
+    PHASE_MERGE,
+    PHASE_INTEGRATE,
+    PHASE_REORDER,
+    PHASE_EXCHANGE, // Distributed runs: essential trees and migration
+    PHASE_COUNT
+};
+
+const char *const PHASE_NAMES[PHASE_COUNT] = {
+    "bbox", "insert", "propagate", "force", "broadphase", "union_find", "merge", "integrate", "reorder", "exchange"};
+
+// Everything measured during one Simulation::step()
+struct StepStats
+{
+    int frame = 0;
+    double phase_seconds[PHASE_COUNT] = {};
+    double step_seconds = 0.0;
+    size_t bodies = 0;
+
+    // Shape of the last tree built or refit during the step
+    size_t tree_nodes = 0;
+    size_t tree_leaves = 0;
+    int tree_depth = 0;
+
+    // Nodes visited per force walk: one walk per body for acc(), one per
+    // group for acc_groups()
+    uint64_t walks = 0;
+    uint64_t walk_visits = 0;
+    uint64_t max_walk_visits = 0;
+
+    size_t collision_pairs = 0;
+    size_t merged_bodies = 0;
+
+    // Heap allocations made during the step, zero once scratch has grown
+    uint64_t allocations = 0;
+
+    double mean_walk_visits() const
+    {
+        return walks > 0 ? static_cast<double>(walk_visits) / walks : 0.0;
+    }
+};
+
+// Keeps the last `capacity` steps in a ring and optionally exports them
+// every export_interval steps: a .json path is rewritten with the whole
+// ring, any other path gets the new steps appended as CSV rows.
+class StatsRecorder
+{
+public:
+    bool enabled = false;
+    size_t capacity = 1024;
+    int export_interval = 0;
+    std::string export_path;
+
+    // The step being recorded, between begin() and end()
+    StepStats current;
+
+    void begin(int frame)
+    {
+#if NBODY_STATS
+        if (!enabled)
+            return;
+        if (ring.capacity() < capacity)
+            ring.reserve(capacity);
+        current = StepStats();
+        current.frame = frame;
+        allocations_at_start = team_allocations();
+        step_start = std::chrono::steady_clock::now();
+#else
+        (void)frame;
+#endif
+    }
+
+    void end()
+    {
+#if NBODY_STATS
+        if (!enabled)
+            return;
+        current.step_seconds = seconds_since(step_start);
+        current.allocations = team_allocations() - allocations_at_start;
+
+        if (ring.size() < capacity)
+            ring.push_back(current);
+        else
+            ring[total % capacity] = current;
+        ++total;
+
+        if (export_interval > 0 && !export_path.empty() && total % export_interval == 0)
+            export_file();
+#endif
+    }
+
+    size_t size() const { return ring.size(); }
+    // Steps recorded since the start, including those the ring dropped
+    uint64_t recorded() const { return total; }
+
+    // i = 0 is the oldest step still in the ring
+    const StepStats &operator[](size_t i) const
+    {
+        return ring.size() < capacity ? ring[i] : ring[(total + i) % capacity];
+    }
+
+    const StepStats &latest() const { return (*this)[ring.size() - 1]; }
+
+    // Per-field mean over the ring; the walk maximum is the largest seen
+    StepStats mean() const
+    {
+        StepStats m;
+        if (ring.empty())
+            return m;
+
+        double bodies = 0.0, nodes = 0.0, leaves = 0.0, depth = 0.0, pairs = 0.0, merged = 0.0;
+        for (const StepStats &s : ring)
+        {
+            for (int p = 0; p < PHASE_COUNT; ++p)
+                m.phase_seconds[p] += s.phase_seconds[p];
+            m.step_seconds += s.step_seconds;
+            m.walks += s.walks;
+            m.walk_visits += s.walk_visits;
+            m.allocations += s.allocations;
+            m.max_walk_visits = std::max(m.max_walk_visits, s.max_walk_visits);
+            bodies += s.bodies;
+            nodes += s.tree_nodes;
+            leaves += s.tree_leaves;
+            depth += s.tree_depth;
+            pairs += s.collision_pairs;
+            merged += s.merged_bodies;
+        }
+
+        const double n = static_cast<double>(ring.size());
+        for (int p = 0; p < PHASE_COUNT; ++p)
+            m.phase_seconds[p] /= n;
+        m.step_seconds /= n;
+        m.allocations = static_cast<uint64_t>(std::ceil(m.allocations / n)); // Any allocation shows
+        m.frame = latest().frame;
+        m.bodies = static_cast<size_t>(bodies / n);
+        m.tree_nodes = static_cast<size_t>(nodes / n);
+        m.tree_leaves = static_cast<size_t>(leaves / n);
+        m.tree_depth = static_cast<int>(depth / n + 0.5);
+        m.collision_pairs = static_cast<size_t>(pairs / n);
+        m.merged_bodies = static_cast<size_t>(merged / n);
+        return m;
+    }
+
+    static void write_csv_header(std::ostream &out)
+    {
+        out << "frame,step_seconds";
+        for (int p = 0; p < PHASE_COUNT; ++p)
+            out << ',' << PHASE_NAMES[p] << "_seconds";
+        out << ",bodies,tree_nodes,tree_leaves,tree_depth,walks,mean_walk_visits,max_walk_visits"
+            << ",collision_pairs,merged_bodies,allocations\n";
+    }
+
+    static void write_csv_row(std::ostream &out, const StepStats &s)
+    {
+        out << s.frame << ',' << s.step_seconds;
+        for (int p = 0; p < PHASE_COUNT; ++p)
+            out << ',' << s.phase_seconds[p];
+        out << ',' << s.bodies << ',' << s.tree_nodes << ',' << s.tree_leaves << ',' << s.tree_depth
+            << ',' << s.walks << ',' << s.mean_walk_visits() << ',' << s.max_walk_visits
+            << ',' << s.collision_pairs << ',' << s.merged_bodies << ',' << s.allocations << '\n';
+    }
+
+    static void write_json_object(std::ostream &out, const StepStats &s)
+    {
+        out << "{\"frame\":" << s.frame << ",\"step_seconds\":" << s.step_seconds << ",\"phases\":{";
+        for (int p = 0; p < PHASE_COUNT; ++p)
+            out << (p ? "," : "") << '"' << PHASE_NAMES[p] << "\":" << s.phase_seconds[p];
+        out << "},\"bodies\":" << s.bodies
+            << ",\"tree\":{\"nodes\":" << s.tree_nodes << ",\"leaves\":" << s.tree_leaves
+            << ",\"depth\":" << s.tree_depth << ",\"walks\":" << s.walks
+            << ",\"mean_walk_visits\":" << s.mean_walk_visits() << ",\"max_walk_visits\":" << s.max_walk_visits
+            << "},\"collisions\":{\"pairs\":" << s.collision_pairs << ",\"merged\":" << s.merged_bodies << "}"
+            << ",\"allocations\":" << s.allocations << "}";
+    }
+
+    // Steps from the ring starting at index first
+    void write_csv(std::ostream &out, size_t first = 0, bool header = true) const
+    {
+        if (header)
+            write_csv_header(out);
+        for (size_t i = first; i < ring.size(); ++i)
+            write_csv_row(out, (*this)[i]);
+    }
+
+    void write_json(std::ostream &out) const
+    {
+        out << "{\"recorded\":" << total << ",\"steps\":[";
+        for (size_t i = 0; i < ring.size(); ++i)
+        {
+            out << (i ? ",\n" : "\n");
+            write_json_object(out, (*this)[i]);
+        }
+        out << "\n],\"mean\":";
+        write_json_object(out, mean());
+        out << "}\n";
+    }
+
+    // Write to export_path now; also called by end() every export_interval steps
+    bool export_file()
+    {
+        const bool json = export_path.size() >= 5 && export_path.compare(export_path.size() - 5, 5, ".json") == 0;
+        if (json)
+        {
+            // Replace atomically so a dashboard never reads half a file
+            const std::string tmp = export_path + ".tmp";
+            {
+                std::ofstream out(tmp);
+                write_json(out);
+                if (!out)
+                {
+                    std::cerr << "Cannot write stats " << tmp << std::endl;
+                    return false;
+                }
+            }
+            return std::rename(tmp.c_str(), export_path.c_str()) == 0;
+        }
+
+        // Steps since the last export that are still in the ring
+        const uint64_t pending = std::min<uint64_t>(total - exported, ring.size());
+        std::ofstream out(export_path, exported == 0 ? std::ios::trunc : std::ios::app);
+        write_csv(out, ring.size() - pending, exported == 0);
+        exported = total;
+        if (!out)
+        {
+            std::cerr << "Cannot write stats " << export_path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<StepStats> ring;
+    uint64_t total = 0;
+    uint64_t exported = 0;
+    std::chrono::steady_clock::time_point step_start;
+    uint64_t allocations_at_start = 0;
+
+    static double seconds_since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    friend class PhaseTimer;
+};
+
+// Adds the lifetime of the timer to one phase of the current step
+class PhaseTimer
+{
+public:
+#if NBODY_STATS
+    PhaseTimer(StatsRecorder &stats, Phase phase)
+        : stats(stats), phase(phase), running(stats.enabled)
+    {
+        if (running)
+            start = std::chrono::steady_clock::now();
+    }
+
+    ~PhaseTimer()
+    {
+        if (running)
+            stats.current.phase_seconds[phase] += StatsRecorder::seconds_since(start);
+    }
+
+    // Close the current phase and start timing another one
+    void next(Phase p)
+    {
+        if (!running)
+            return;
+        const auto now = std::chrono::steady_clock::now();
+        stats.current.phase_seconds[phase] += std::chrono::duration<double>(now - start).count();
+        phase = p;
+        start = now;
+    }
+
+private:
+    StatsRecorder &stats;
+    Phase phase;
+    bool running;
+    std::chrono::steady_clock::time_point start;
+#else
+    PhaseTimer(StatsRecorder &, Phase)
+    {
+    }
+
+    void next(Phase)
+    {
+    }
+#endif
+};
+
+#endif
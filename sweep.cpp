@@ -0,0 +1,432 @@
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <glm/glm.hpp>
+#include <glm/gtx/norm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include "body.h"
+#include "body_soa.h"
+#include "quadtree.h"
+#include "fmm.h"
+#include "direct.h"
+#include "simulation.h"
+#include "options.h"
+
+// Accuracy/speed sweep of the force paths against direct summation. For
+// every N, theta, leaf size and path (group and scalar Barnes-Hut,
+// quadrupole, FMM) it prints the wall time of one force evaluation and the
+// RMS and max relative force error against the exact kernel summed in
+// double, the direct kernel's own error included, then the N below which
+// direct summation is faster at --crossover-theta. The sun's net force
+// nearly cancels, so its relative error is printed apart as sun_error.
+// With --refits K it also checks the forces after K incremental refits
+// with the largest of --leaf-sizes against a fresh build of the same
+// positions. Bodies come from --seed. Usage:
+//   sweep [--sizes N,N,...] [--thetas F,F,...] [--leaf-sizes B,B,...]
+//         [--epsilon F] [--sample K] [--repeats R] [--threads T] [--seed S]
+//         [--crossover-theta F] [--max-crossover N] [--refits K]
+
+const int NUM_BODIES = 100000;
+const bool COLLISION = false;
+
+const float X_MEAN = NUM_BODIES <= 25000 ? 10.0 : 15.0;
+const float X_STD = NUM_BODIES <= 25000 ? 3.0 : 10.0;
+const float Y_MEAN = 0.0;
+const float Y_STD = NUM_BODIES <= 25000 ? 5.0 : 10.0;
+const float MASS_SUN = 10000.0;
+
+struct Options
+{
+    std::vector<int> sizes = {1000, 10000, 100000, 1000000};
+    std::vector<float> thetas = {0.3f, 0.5f, 0.7f, 1.0f, 1.5f};
+    std::vector<int> leaf_sizes = {1, static_cast<int>(FMM_LEAF_SIZE)};
+    float epsilon = EPSILON;
+    int sample = 4096; // Bodies whose error is measured, the reference is O(N * sample)
+    int repeats = 3;   // Timings keep the fastest run
+    int threads = 0;
+    uint64_t seed = 1;
+    float crossover_theta = THETA;
+    int max_crossover = 1 << 16;
+    int refits = 20; // Refit steps before the refit check, 0 skips it
+};
+
+void usage(const char *prog)
+{
+    std::cerr << "Usage: " << prog
+              << " [--sizes N,N,...] [--thetas F,F,...] [--leaf-sizes B,B,...]"
+              << " [--epsilon F] [--sample K] [--repeats R] [--threads T] [--seed S]"
+              << " [--crossover-theta F] [--max-crossover N] [--refits K]" << std::endl;
+}
+
+bool parse_options(int argc, char **argv, Options &opt)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+
+        if (arg == "--sizes" && has_value)
+        {
+            if (!parse_list(argv[++i], opt.sizes))
+                return false;
+        }
+        else if (arg == "--thetas" && has_value)
+        {
+            if (!parse_list(argv[++i], opt.thetas))
+                return false;
+        }
+        else if (arg == "--leaf-sizes" && has_value)
+        {
+            if (!parse_list(argv[++i], opt.leaf_sizes))
+                return false;
+        }
+        else if (arg == "--epsilon" && has_value)
+            opt.epsilon = std::atof(argv[++i]);
+        else if (arg == "--sample" && has_value)
+            opt.sample = std::atoi(argv[++i]);
+        else if (arg == "--repeats" && has_value)
+            opt.repeats = std::atoi(argv[++i]);
+        else if (arg == "--threads" && has_value)
+            opt.threads = std::atoi(argv[++i]);
+        else if (arg == "--seed" && has_value)
+            opt.seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--crossover-theta" && has_value)
+            opt.crossover_theta = std::atof(argv[++i]);
+        else if (arg == "--max-crossover" && has_value)
+            opt.max_crossover = std::atoi(argv[++i]);
+        else if (arg == "--refits" && has_value)
+            opt.refits = std::atoi(argv[++i]);
+        else
+        {
+            std::cerr << "Unknown or incomplete option: " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (opt.epsilon < 0.0f || opt.sample <= 0 || opt.repeats <= 0 || opt.threads < 0 || opt.seed == 0 ||
+        opt.crossover_theta <= 0.0f || opt.max_crossover <= 0 || opt.refits < 0)
+    {
+        std::cerr << "Invalid option value" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+template <typename F>
+double fastest(int repeats, F run)
+{
+    double best = 0.0;
+    for (int r = 0; r < repeats; ++r)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        run();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = r == 0 ? seconds : std::min(best, seconds);
+    }
+    return best;
+}
+
+// Force paths the sweep compares
+enum class Walk
+{
+    Group,      // acc_groups(), the default --force bh path
+    Scalar,     // acc() per body
+    Quadrupole, // acc_quadrupole() per body, --force quad
+    Multipole   // FastMultipole, --force fmm
+};
+
+const char *walk_name(Walk walk)
+{
+    switch (walk)
+    {
+    case Walk::Group:
+        return "group";
+    case Walk::Scalar:
+        return "scalar";
+    case Walk::Quadrupole:
+        return "quad";
+    default:
+        return "fmm";
+    }
+}
+
+// Tree build plus one force evaluation for every body, as attract() does
+void tree_forces(Quadtree &qt, BodySoA &bodies, Walk walk, FastMultipole &fmm)
+{
+    qt.build(bodies, new_quadtree(bodies));
+    qt.propagate_levels();
+    if (walk == Walk::Group)
+    {
+        qt.acc_groups(bodies);
+        return;
+    }
+
+    if (walk != Walk::Scalar)
+        qt.propagate_moments();
+    if (walk == Walk::Multipole)
+    {
+        fmm.evaluate(qt, bodies);
+        return;
+    }
+
+#pragma omp parallel for schedule(dynamic, 256)
+    for (size_t i = 0; i < bodies.size(); ++i)
+    {
+        const glm::vec2 pos = bodies.position(i);
+        const glm::vec2 a = walk == Walk::Quadrupole ? qt.acc_quadrupole(pos) : qt.acc(pos);
+        bodies.ax[i] = a.x;
+        bodies.ay[i] = a.y;
+    }
+}
+
+// Accelerations the errors are measured against, in double
+struct ReferenceForces
+{
+    std::vector<double> ax, ay;
+
+    void load(const BodySoA &bodies)
+    {
+        ax.assign(bodies.ax.begin(), bodies.ax.end());
+        ay.assign(bodies.ay.begin(), bodies.ay.end());
+    }
+};
+
+// Same softened kernel as accumulate(), every term and sum in double, for
+// the sampled targets only
+void exact_forces(const BodySoA &bodies, float epsilon, const std::vector<uint8_t> &sampled, ReferenceForces &reference)
+{
+    const double e_2 = static_cast<double>(epsilon) * epsilon;
+    reference.ax.assign(bodies.size(), 0.0);
+    reference.ay.assign(bodies.size(), 0.0);
+
+#pragma omp parallel for schedule(dynamic, 16)
+    for (size_t i = 0; i < bodies.size(); ++i)
+    {
+        if (!sampled[i])
+            continue;
+        double ax = 0.0, ay = 0.0;
+        for (size_t k = 0; k < bodies.size(); ++k)
+        {
+            const double dx = static_cast<double>(bodies.x[k]) - bodies.x[i];
+            const double dy = static_cast<double>(bodies.y[k]) - bodies.y[i];
+            const double d_sq = dx * dx + dy * dy;
+            if (d_sq > 0.0)
+            {
+                const double f = bodies.mass[k] / ((d_sq + e_2) * std::sqrt(d_sq));
+                ax += dx * f;
+                ay += dy * f;
+            }
+        }
+        reference.ax[i] = ax;
+        reference.ay[i] = ay;
+    }
+}
+
+double relative_error(const BodySoA &bodies, const ReferenceForces &reference, size_t i)
+{
+    const double ref = std::hypot(reference.ax[i], reference.ay[i]);
+    return ref > 0.0 ? std::hypot(bodies.ax[i] - reference.ax[i], bodies.ay[i] - reference.ay[i]) / ref : 0.0;
+}
+
+// RMS and max of |a - a_ref| / |a_ref| over the sampled bodies
+void force_error(const BodySoA &bodies, const ReferenceForces &reference, const std::vector<uint8_t> &sampled,
+                 double &rms, double &max)
+{
+    double sum_sq = 0.0;
+    double worst = 0.0;
+    size_t count = 0;
+
+#pragma omp parallel for reduction(+ : sum_sq, count) reduction(max : worst)
+    for (size_t i = 0; i < bodies.size(); ++i)
+    {
+        const double ref = std::hypot(reference.ax[i], reference.ay[i]);
+        if (!sampled[i] || ref == 0.0)
+            continue;
+        const double err = std::hypot(bodies.ax[i] - reference.ax[i], bodies.ay[i] - reference.ay[i]) / ref;
+        sum_sq += err * err;
+        worst = std::max(worst, err);
+        ++count;
+    }
+
+    rms = count > 0 ? std::sqrt(sum_sq / count) : 0.0;
+    max = worst;
+}
+
+// Step an incremental-tree Simulation until it has refit `refits` times,
+// then compare its forces with a fresh build of the same positions. The
+// trees differ in shape, so only errors far above the theta error are bugs.
+void refit_error(int n, float theta, int leaf_size, const Options &opt, double &rms, double &max, size_t &refits)
+{
+    std::vector<Body> bodies;
+    bodies.reserve(n);
+    InitialConditions ic;
+    ic.seed = opt.seed;
+    initializeBodies(bodies, std::max(n - 1, 0), ic);
+    // A short step keeps most bodies in their leaves so refits succeed
+    Simulation sim(static_cast<int>(bodies.size()), 0.001f, bodies, theta, opt.epsilon, false);
+    sim.incremental_tree = true;
+    sim.direct_crossover = 0;
+    sim.qt.leaf_size = static_cast<size_t>(leaf_size);
+    for (int s = 0; s < 4 * opt.refits && sim.qt.refits < static_cast<size_t>(opt.refits); ++s)
+        sim.step();
+    sim.attract();
+    refits = sim.qt.refits;
+
+    BodySoA fresh = sim.soa;
+    Quadtree qt(theta, opt.epsilon);
+    qt.leaf_size = static_cast<size_t>(leaf_size);
+    FastMultipole unused;
+    tree_forces(qt, fresh, Walk::Group, unused);
+    ReferenceForces reference;
+    reference.load(fresh);
+    force_error(sim.soa, reference, std::vector<uint8_t>(fresh.size(), 1), rms, max);
+}
+
+BodySoA make_bodies(int n, uint64_t seed)
+{
+    std::vector<Body> bodies;
+    bodies.reserve(n);
+    // initializeBodies() adds the sun on top of its count
+    InitialConditions ic;
+    ic.seed = seed;
+    initializeBodies(bodies, std::max(n - 1, 0), ic);
+    BodySoA soa;
+    soa.load(bodies);
+    return soa;
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    if (!parse_options(argc, argv, opt))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (opt.threads > 0)
+        omp_set_num_threads(opt.threads);
+
+    const float e_2 = opt.epsilon * opt.epsilon;
+    DirectSummation direct;
+    FastMultipole fmm;
+
+    std::cout << "threads=" << omp_get_max_threads()
+              << " simd=" << FORCE_SIMD_WIDTH
+              << " epsilon=" << opt.epsilon
+              << " sample=" << opt.sample << std::endl;
+
+    for (const int n : opt.sizes)
+    {
+        BodySoA bodies = make_bodies(n, opt.seed);
+        const size_t sun = std::max_element(bodies.mass.begin(), bodies.mass.end()) - bodies.mass.begin();
+
+        // Exact forces for an evenly spaced sample of the other bodies and
+        // for the sun; the sample's cost scales the direct timing up to all
+        // n targets
+        const size_t stride = std::max<size_t>(1, bodies.size() / opt.sample);
+        std::vector<uint8_t> sampled(bodies.size(), 0);
+        size_t sample_count = 0;
+        for (size_t i = 0; i < bodies.size(); i += stride)
+        {
+            sampled[i] = i != sun;
+            sample_count += sampled[i];
+        }
+        sample_count = std::max<size_t>(sample_count, 1);
+
+        std::vector<uint8_t> with_sun = sampled;
+        with_sun[sun] = 1;
+        ReferenceForces reference;
+        exact_forces(bodies, opt.epsilon, with_sun, reference);
+
+        BodySoA summed = bodies;
+        const double sample_seconds = fastest(opt.repeats, [&]
+                                              { direct.evaluate(summed, e_2, sampled); });
+        const double direct_seconds = sample_seconds * bodies.size() / sample_count;
+
+        double direct_rms = 0.0, direct_max = 0.0;
+        force_error(summed, reference, sampled, direct_rms, direct_max);
+        std::cout << "n=" << bodies.size() << " method=direct seconds=" << direct_seconds
+                  << " interactions/sec=" << static_cast<double>(bodies.size()) * sample_count / sample_seconds
+                  << " rms_error=" << direct_rms
+                  << " max_error=" << direct_max << std::endl;
+
+        for (const int leaf_size : opt.leaf_sizes)
+        {
+            for (const float theta : opt.thetas)
+            {
+                for (const Walk walk : {Walk::Group, Walk::Scalar, Walk::Quadrupole, Walk::Multipole})
+                {
+                    Quadtree qt(theta, opt.epsilon);
+                    qt.leaf_size = static_cast<size_t>(leaf_size);
+                    BodySoA evaluated = bodies;
+                    const double seconds = fastest(opt.repeats, [&]
+                                                   { tree_forces(qt, evaluated, walk, fmm); });
+
+                    double rms = 0.0, max = 0.0;
+                    force_error(evaluated, reference, sampled, rms, max);
+                    std::cout << "n=" << bodies.size()
+                              << " method=" << walk_name(walk)
+                              << " theta=" << theta
+                              << " leaf_size=" << leaf_size
+                              << " seconds=" << seconds
+                              << " speedup=" << direct_seconds / seconds
+                              << " rms_error=" << rms
+                              << " max_error=" << max
+                              << " sun_error=" << relative_error(evaluated, reference, sun) << std::endl;
+                }
+            }
+        }
+
+        if (opt.refits > 0)
+        {
+            double rms = 0.0, max = 0.0;
+            size_t refits = 0;
+            const float theta = *std::min_element(opt.thetas.begin(), opt.thetas.end());
+            const int leaf_size = *std::max_element(opt.leaf_sizes.begin(), opt.leaf_sizes.end());
+            refit_error(n, theta, leaf_size, opt, rms, max, refits);
+            std::cout << "n=" << bodies.size()
+                      << " method=refit theta=" << theta
+                      << " leaf_size=" << leaf_size
+                      << " refits=" << refits
+                      << " rms_vs_build=" << rms
+                      << " max_vs_build=" << max << std::endl;
+        }
+    }
+
+    // Smallest power of two where the production tree path beats the direct kernel
+    int crossover = 0;
+    for (int n = 64; n <= opt.max_crossover && crossover == 0; n *= 2)
+    {
+        BodySoA bodies = make_bodies(n, opt.seed);
+        BodySoA copy = bodies;
+        Quadtree qt(opt.crossover_theta, opt.epsilon);
+        const double tree_seconds = fastest(opt.repeats * 5, [&]
+                                            { tree_forces(qt, copy, Walk::Group, fmm); });
+        const double direct_seconds = fastest(opt.repeats * 5, [&]
+                                              { direct.evaluate(bodies, e_2); });
+        std::cout << "crossover_probe n=" << n << " tree_seconds=" << tree_seconds
+                  << " direct_seconds=" << direct_seconds << std::endl;
+        if (tree_seconds < direct_seconds)
+            crossover = n;
+    }
+
+    std::cout << "crossover_theta=" << opt.crossover_theta << " crossover_n=";
+    if (crossover > 0)
+        std::cout << crossover;
+    else
+        std::cout << ">" << opt.max_crossover;
+    std::cout << " (DIRECT_CROSSOVER=" << DIRECT_CROSSOVER << ")" << std::endl;
+
+    return 0;
+}
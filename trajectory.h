@@ -0,0 +1,582 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include "body_soa.h"
+#include "quadtree.h"
+
+// Trajectory file: a header, then one record per recorded frame, then an
+// index of the records for seeking. Each record stores the body ids in
+// ascending order as gaps, and the positions quantized to the frame's
+// bounding square. Delta records predict every quantized coordinate from
+// the same body in the previous record, carried over to this record's
+// grid; keyframes predict from zero. Everything is packed as zigzag LEB128
+// varints.
+constexpr char TRAJECTORY_MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'T', 'R', 'J'};
+constexpr char TRAJECTORY_INDEX_MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'I', 'D', 'X'};
+constexpr uint32_t TRAJECTORY_VERSION = 2;
+
+struct TrajectoryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t bits; // Quantization bits per coordinate
+    uint32_t keyframe_interval;
+    uint32_t reserved;
+};
+
+struct TrajectoryRecord
+{
+    int64_t frame;
+    uint32_t count;
+    uint32_t keyframe;
+    float min_x, min_y, size;
+    uint32_t reserved;
+    uint64_t payload_bytes;
+};
+
+struct TrajectoryIndexEntry
+{
+    int64_t frame;
+    uint64_t offset;
+    uint32_t keyframe;
+    uint32_t reserved;
+};
+
+struct TrajectoryFooter
+{
+    uint64_t index_offset;
+    uint64_t records;
+    char magic[8];
+};
+
+void put_varint(std::vector<uint8_t> &out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+// Returns false on a truncated stream
+bool get_varint(const uint8_t *&p, const uint8_t *end, uint64_t &v)
+{
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7)
+    {
+        const uint8_t byte = *p++;
+        v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+uint64_t zigzag(int64_t v)
+{
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+int64_t unzigzag(uint64_t v)
+{
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+// Coordinate q quantized on the grid from min, side size, requantized onto
+// the grid from to_min, side to_size. Writer and reader both predict delta
+// records through this, so their predictions agree exactly.
+int64_t regrid(uint32_t q, float min, float size, float to_min, float to_size, uint32_t max_q)
+{
+    if (to_size <= 0.0f)
+        return 0;
+    const double x = min + static_cast<double>(q) * size / max_q;
+    return std::llround((x - to_min) * max_q / to_size);
+}
+
+// Streams positions to a trajectory file. record() copies ids and
+// positions into a free slot of a fixed ring and returns; quantization,
+// encoding and I/O happen on a background thread. When every slot is
+// still waiting to be written the frame is dropped rather than stalling
+// the step loop, so memory stays bounded at queue_depth frames.
+class TrajectoryWriter
+{
+public:
+    int interval = 0; // Steps between recorded frames
+    uint32_t bits = 16;
+    uint32_t keyframe_interval = 32; // Records between keyframes, bounds seek cost
+    size_t queue_depth = 4;
+
+    // Totals, read after close()
+    size_t recorded = 0;
+    size_t dropped = 0;
+    uint64_t bytes = 0;
+
+    TrajectoryWriter() = default;
+    TrajectoryWriter(const TrajectoryWriter &) = delete;
+    TrajectoryWriter &operator=(const TrajectoryWriter &) = delete;
+
+    ~TrajectoryWriter()
+    {
+        close();
+    }
+
+    bool open(const std::string &path, int every)
+    {
+        close();
+        file = std::fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            std::cerr << "Cannot write trajectory " << path << std::endl;
+            return false;
+        }
+
+        bits = std::clamp(bits, 1u, 24u);
+        TrajectoryHeader h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, TRAJECTORY_MAGIC, sizeof(h.magic));
+        h.version = TRAJECTORY_VERSION;
+        h.bits = bits;
+        h.keyframe_interval = std::max(keyframe_interval, 1u);
+        std::fwrite(&h, sizeof(h), 1, file);
+
+        interval = every;
+        recorded = dropped = 0;
+        bytes = sizeof(h);
+        index.clear();
+        slots.assign(std::max<size_t>(queue_depth, 1), Slot());
+        head = tail = 0;
+        quit = false;
+        worker = std::thread(&TrajectoryWriter::run, this);
+        return true;
+    }
+
+    bool is_open() const { return file != nullptr; }
+
+    // Drains the queue, appends the index and closes the file
+    void close()
+    {
+        if (!file)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        worker.join();
+
+        // After a failed write the records are left for readers to scan
+        if (!failed)
+        {
+            TrajectoryFooter footer;
+            std::memset(&footer, 0, sizeof(footer));
+            footer.index_offset = bytes;
+            footer.records = index.size();
+            std::memcpy(footer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(footer.magic));
+            std::fwrite(index.data(), sizeof(TrajectoryIndexEntry), index.size(), file);
+            std::fwrite(&footer, sizeof(footer), 1, file);
+            bytes += index.size() * sizeof(TrajectoryIndexEntry) + sizeof(footer);
+        }
+
+        if (std::fclose(file) != 0)
+            std::cerr << "Failed to close trajectory" << std::endl;
+        file = nullptr;
+    }
+
+    // Queue the current frame; never waits for the writer thread
+    void record(const BodySoA &bodies, int frame)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (head - tail == slots.size())
+            {
+                ++dropped;
+                return;
+            }
+        }
+
+        // Only this thread touches the slot until head moves past it
+        Slot &slot = slots[head % slots.size()];
+        slot.frame = frame;
+        slot.bounds = new_quadtree(bodies);
+        slot.x.assign(bodies.x.begin(), bodies.x.end());
+        slot.y.assign(bodies.y.begin(), bodies.y.end());
+        slot.id.assign(bodies.id.begin(), bodies.id.end());
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++head;
+        }
+        wake.notify_one();
+    }
+
+private:
+    struct Slot
+    {
+        int frame = 0;
+        Quad bounds = Quad(glm::vec2(0), 0.0f);
+        std::vector<float> x, y;
+        std::vector<uint32_t> id;
+    };
+
+    FILE *file = nullptr;
+    std::vector<TrajectoryIndexEntry> index;
+
+    // Ring of frames, slots[tail % size] .. slots[head % size] are queued
+    std::vector<Slot> slots;
+    size_t head = 0;
+    size_t tail = 0;
+    bool quit = false;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread worker;
+
+    // Writer thread state: the previous record's grid, its ids and
+    // quantized coordinates in id order, and encoding scratch
+    float prev_min_x = 0.0f, prev_min_y = 0.0f, prev_size = 0.0f;
+    std::vector<uint32_t> prev_id, prev_qx, prev_qy;
+    std::vector<uint32_t> cur_id, cur_qx, cur_qy;
+    std::vector<uint64_t> order;
+    std::vector<uint8_t> payload;
+    bool failed = false; // A short write leaves the file unusable past its last record
+
+    void run()
+    {
+        prev_id.clear();
+        failed = false;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]
+                          { return head != tail || quit; });
+                if (head == tail)
+                    return;
+            }
+
+            if (!failed)
+                failed = !encode(slots[tail % slots.size()]);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            ++tail;
+        }
+    }
+
+    bool encode(const Slot &slot)
+    {
+        const size_t count = slot.id.size();
+        const float min_x = slot.bounds.center.x - slot.bounds.size * 0.5f;
+        const float min_y = slot.bounds.center.y - slot.bounds.size * 0.5f;
+        const uint32_t max_q = (1u << bits) - 1;
+        const float size = slot.bounds.size;
+        const float scale = size > 0.0f ? max_q / size : 0.0f;
+
+        // Bodies in id order; usually already sorted unless reordered
+        order.resize(count);
+        for (size_t i = 0; i < count; ++i)
+            order[i] = (static_cast<uint64_t>(slot.id[i]) << 32) | i;
+        if (!std::is_sorted(order.begin(), order.end()))
+            std::sort(order.begin(), order.end());
+
+        cur_id.resize(count);
+        cur_qx.resize(count);
+        cur_qy.resize(count);
+        for (size_t k = 0; k < count; ++k)
+        {
+            const size_t i = static_cast<uint32_t>(order[k]);
+            cur_id[k] = static_cast<uint32_t>(order[k] >> 32);
+            cur_qx[k] = std::min(max_q, static_cast<uint32_t>(std::lround((slot.x[i] - min_x) * scale)));
+            cur_qy[k] = std::min(max_q, static_cast<uint32_t>(std::lround((slot.y[i] - min_y) * scale)));
+        }
+
+        const bool keyframe = index.size() % std::max(keyframe_interval, 1u) == 0;
+        payload.clear();
+        uint32_t last_id = 0;
+        for (size_t k = 0; k < count; ++k)
+        {
+            put_varint(payload, cur_id[k] - last_id);
+            last_id = cur_id[k];
+        }
+
+        // Merge walk against the previous record, both in id order
+        size_t p = 0;
+        for (size_t k = 0; k < count; ++k)
+        {
+            int64_t px = 0, py = 0;
+            if (!keyframe)
+            {
+                while (p < prev_id.size() && prev_id[p] < cur_id[k])
+                    ++p;
+                if (p < prev_id.size() && prev_id[p] == cur_id[k])
+                {
+                    px = regrid(prev_qx[p], prev_min_x, prev_size, min_x, size, max_q);
+                    py = regrid(prev_qy[p], prev_min_y, prev_size, min_y, size, max_q);
+                }
+            }
+            put_varint(payload, zigzag(static_cast<int64_t>(cur_qx[k]) - px));
+            put_varint(payload, zigzag(static_cast<int64_t>(cur_qy[k]) - py));
+        }
+
+        TrajectoryRecord r;
+        std::memset(&r, 0, sizeof(r));
+        r.frame = slot.frame;
+        r.count = static_cast<uint32_t>(count);
+        r.keyframe = keyframe;
+        r.min_x = min_x;
+        r.min_y = min_y;
+        r.size = size;
+        r.payload_bytes = payload.size();
+
+        TrajectoryIndexEntry entry;
+        std::memset(&entry, 0, sizeof(entry));
+        entry.frame = r.frame;
+        entry.offset = bytes;
+        entry.keyframe = r.keyframe;
+
+        const bool ok = std::fwrite(&r, sizeof(r), 1, file) == 1 &&
+                        std::fwrite(payload.data(), 1, payload.size(), file) == payload.size();
+        if (!ok)
+        {
+            std::cerr << "Failed to write trajectory frame " << r.frame << ", stopping" << std::endl;
+            return false;
+        }
+
+        index.push_back(entry);
+        bytes += sizeof(r) + payload.size();
+        prev_id.swap(cur_id);
+        prev_qx.swap(cur_qx);
+        prev_qy.swap(cur_qy);
+        prev_min_x = min_x;
+        prev_min_y = min_y;
+        prev_size = size;
+        std::lock_guard<std::mutex> lock(mutex);
+        ++recorded;
+        return true;
+    }
+};
+
+// One decoded frame, bodies in ascending id order
+struct TrajectoryFrame
+{
+    int64_t frame = -1;
+    std::vector<uint32_t> id;
+    std::vector<float> x, y;
+};
+
+// Random access to a trajectory file. read() decodes forward from the
+// nearest keyframe at or before the requested record, or from the last
+// record read when that is closer, so sequential reads cost one record.
+class TrajectoryReader
+{
+public:
+    TrajectoryReader() = default;
+    TrajectoryReader(const TrajectoryReader &) = delete;
+    TrajectoryReader &operator=(const TrajectoryReader &) = delete;
+
+    ~TrajectoryReader()
+    {
+        close();
+    }
+
+    // Uses the index when present, otherwise scans the records, which
+    // recovers every complete frame of a file whose writer never closed
+    bool open(const std::string &path)
+    {
+        close();
+        file = std::fopen(path.c_str(), "rb");
+        if (!file)
+        {
+            std::cerr << "Cannot open trajectory " << path << std::endl;
+            return false;
+        }
+
+        if (std::fread(&header, sizeof(header), 1, file) != 1 ||
+            std::memcmp(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != TRAJECTORY_VERSION || header.bits < 1 || header.bits > 24)
+        {
+            std::cerr << "Trajectory " << path << " has an unsupported format" << std::endl;
+            close();
+            return false;
+        }
+
+        if (!read_index())
+            scan_records();
+        return true;
+    }
+
+    void close()
+    {
+        if (file)
+            std::fclose(file);
+        file = nullptr;
+        index.clear();
+        current = SIZE_MAX;
+    }
+
+    size_t size() const { return index.size(); }
+    int64_t frame_number(size_t record) const { return index[record].frame; }
+
+    // First record at or after the given simulation frame, size() if none
+    size_t find(int64_t frame) const
+    {
+        const auto it = std::lower_bound(index.begin(), index.end(), frame, [](const TrajectoryIndexEntry &e, int64_t f)
+                                         { return e.frame < f; });
+        return static_cast<size_t>(it - index.begin());
+    }
+
+    bool read(size_t record, TrajectoryFrame &out)
+    {
+        if (record >= index.size())
+            return false;
+
+        size_t start = record;
+        while (!index[start].keyframe && start > 0)
+            --start;
+        if (current != SIZE_MAX && current <= record && current >= start)
+            start = current + 1;
+
+        for (size_t r = start; r <= record; ++r)
+        {
+            if (!decode(r))
+            {
+                current = SIZE_MAX;
+                return false;
+            }
+            current = r;
+        }
+
+        const float inv_scale = extent > 0.0f ? extent / static_cast<float>((1u << header.bits) - 1) : 0.0f;
+        out.frame = index[record].frame;
+        out.id = qid;
+        out.x.resize(qid.size());
+        out.y.resize(qid.size());
+        for (size_t k = 0; k < qid.size(); ++k)
+        {
+            out.x[k] = min_x + qx[k] * inv_scale;
+            out.y[k] = min_y + qy[k] * inv_scale;
+        }
+        return true;
+    }
+
+private:
+    FILE *file = nullptr;
+    TrajectoryHeader header;
+    std::vector<TrajectoryIndexEntry> index;
+
+    // Last decoded record, the prediction for the next one
+    size_t current = SIZE_MAX;
+    float min_x = 0.0f, min_y = 0.0f, extent = 0.0f;
+    std::vector<uint32_t> qid, qx, qy;
+    std::vector<uint32_t> next_id, next_qx, next_qy;
+    std::vector<uint8_t> payload;
+
+    bool read_index()
+    {
+        TrajectoryFooter footer;
+        if (std::fseek(file, -static_cast<long>(sizeof(footer)), SEEK_END) != 0 ||
+            std::fread(&footer, sizeof(footer), 1, file) != 1 ||
+            std::memcmp(footer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(footer.magic)) != 0)
+            return false;
+
+        index.resize(footer.records);
+        return std::fseek(file, static_cast<long>(footer.index_offset), SEEK_SET) == 0 &&
+               std::fread(index.data(), sizeof(TrajectoryIndexEntry), index.size(), file) == index.size();
+    }
+
+    void scan_records()
+    {
+        index.clear();
+        std::fseek(file, 0, SEEK_END);
+        const uint64_t file_size = static_cast<uint64_t>(std::ftell(file));
+
+        uint64_t offset = sizeof(header);
+        TrajectoryRecord r;
+        while (std::fseek(file, static_cast<long>(offset), SEEK_SET) == 0 &&
+               std::fread(&r, sizeof(r), 1, file) == 1)
+        {
+            // A record cut short by a crash ends the scan
+            if (offset + sizeof(r) + r.payload_bytes > file_size)
+                break;
+
+            TrajectoryIndexEntry entry;
+            std::memset(&entry, 0, sizeof(entry));
+            entry.frame = r.frame;
+            entry.offset = offset;
+            entry.keyframe = r.keyframe;
+            index.push_back(entry);
+            offset += sizeof(r) + r.payload_bytes;
+        }
+    }
+
+    bool decode(size_t record)
+    {
+        TrajectoryRecord r;
+        if (std::fseek(file, static_cast<long>(index[record].offset), SEEK_SET) != 0 ||
+            std::fread(&r, sizeof(r), 1, file) != 1)
+            return false;
+        payload.resize(r.payload_bytes);
+        if (std::fread(payload.data(), 1, payload.size(), file) != payload.size())
+            return false;
+
+        const uint8_t *p = payload.data();
+        const uint8_t *end = p + payload.size();
+        const uint32_t max_q = (1u << header.bits) - 1;
+        next_id.resize(r.count);
+        next_qx.resize(r.count);
+        next_qy.resize(r.count);
+
+        uint64_t v = 0;
+        uint32_t last_id = 0;
+        for (size_t k = 0; k < r.count; ++k)
+        {
+            if (!get_varint(p, end, v))
+                return false;
+            last_id += static_cast<uint32_t>(v);
+            next_id[k] = last_id;
+        }
+
+        size_t q = 0;
+        for (size_t k = 0; k < r.count; ++k)
+        {
+            int64_t px = 0, py = 0;
+            if (!r.keyframe)
+            {
+                while (q < qid.size() && qid[q] < next_id[k])
+                    ++q;
+                if (q < qid.size() && qid[q] == next_id[k])
+                {
+                    px = regrid(qx[q], min_x, extent, r.min_x, r.size, max_q);
+                    py = regrid(qy[q], min_y, extent, r.min_y, r.size, max_q);
+                }
+            }
+
+            uint64_t dx = 0, dy = 0;
+            if (!get_varint(p, end, dx) || !get_varint(p, end, dy))
+                return false;
+            next_qx[k] = static_cast<uint32_t>(px + unzigzag(dx));
+            next_qy[k] = static_cast<uint32_t>(py + unzigzag(dy));
+        }
+
+        qid.swap(next_id);
+        qx.swap(next_qx);
+        qy.swap(next_qy);
+        min_x = r.min_x;
+        min_y = r.min_y;
+        extent = r.size;
+        return true;
+    }
+};
+
+#endif
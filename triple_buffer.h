@@ -0,0 +1,42 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single-producer, single-consumer triple buffer. The writer
+// fills back() and publish()es it; the reader's front() returns the latest
+// published value and keeps it stable until its next call. Neither side
+// ever waits for the other, stale values are simply skipped.
+template <typename T>
+class TripleBuffer
+{
+public:
+    // Writer side
+    T &back() { return slots[back_index]; }
+
+    void publish()
+    {
+        back_index = state.exchange(back_index | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Reader side
+    const T &front()
+    {
+        if (state.load(std::memory_order_relaxed) & FRESH)
+            front_index = state.exchange(front_index, std::memory_order_acq_rel) & INDEX;
+        return slots[front_index];
+    }
+
+private:
+    static constexpr uint8_t INDEX = 3;
+    static constexpr uint8_t FRESH = 4;
+
+    T slots[3];
+    uint8_t back_index = 0;
+    uint8_t front_index = 1;
+    // Index of the middle slot, plus FRESH when the reader has not seen it
+    std::atomic<uint8_t> state{2};
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef UNION_FIND_H
+#define UNION_FIND_H
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+// Lock-free disjoint sets for concurrent unite() and find() from many
+// threads. Roots are only ever linked below a smaller root, so every
+// parent index is at most its child's and each set's root is its smallest
+// element. Storage grows on demand and is reused across reset() calls.
+class ConcurrentDisjointSets
+{
+public:
+    void reset(size_t n)
+    {
+        if (n > capacity)
+        {
+            parent.reset(new std::atomic<uint32_t>[n]);
+            capacity = n;
+        }
+        count = n;
+
+#pragma omp parallel for
+        for (size_t i = 0; i < n; ++i)
+            parent[i].store(static_cast<uint32_t>(i), std::memory_order_relaxed);
+    }
+
+    size_t size() const noexcept { return count; }
+
+    // Root of x with path halving; a failed halving CAS is harmless
+    uint32_t find(uint32_t x)
+    {
+        while (true)
+        {
+            uint32_t p = parent[x].load(std::memory_order_acquire);
+            if (p == x)
+                return x;
+
+            const uint32_t gp = parent[p].load(std::memory_order_acquire);
+            if (gp != p)
+                parent[x].compare_exchange_weak(p, gp, std::memory_order_acq_rel);
+            x = gp;
+        }
+    }
+
+    bool is_root(uint32_t x) const
+    {
+        return parent[x].load(std::memory_order_acquire) == x;
+    }
+
+    void unite(uint32_t a, uint32_t b)
+    {
+        while (true)
+        {
+            a = find(a);
+            b = find(b);
+            if (a == b)
+                return;
+            if (a < b)
+                std::swap(a, b);
+
+            // Link the larger root a below b, retry if a stopped being a root
+            uint32_t expected = a;
+            if (parent[a].compare_exchange_weak(expected, b, std::memory_order_acq_rel))
+                return;
+        }
+    }
+
+private:
+    std::unique_ptr<std::atomic<uint32_t>[]> parent;
+    size_t capacity = 0;
+    size_t count = 0;
+};
+
+#endif
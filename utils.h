@@ -7,21 +7,7 @@ void error_callback(int error, const char *description)
     std::cerr << "GLFW Error: " << description << std::endl;
 }
 
-// Draw a circle using GL_TRIANGLE_FAN
-void drawCircle(float cx, float cy, float r, int num_segments)
-{
-    glBegin(GL_TRIANGLE_FAN);
-    for (int i = 0; i <= num_segments; i++)
-    {
-        float theta = 2.0f * M_PI * float(i) / float(num_segments);
-        float x = r * cos(theta);
-        float y = r * sin(theta);
-        glVertex2f(x + cx, y + cy);
-    }
-    glEnd();
-}
-
-void controls(GLFWwindow *window, float *camScale, float *camX, float *camY, float resetScaleValue, bool *shouldMove)
+void controls(GLFWwindow *window, float *camScale, float *camX, float *camY, float resetScaleValue)
 {
     float panSpeed = *camScale * 0.01f; // Pan speed is proportional to the current zoom
     float zoomSpeed = 1.0f;             // Fixed zoom speed
@@ -40,11 +26,6 @@ void controls(GLFWwindow *window, float *camScale, float *camX, float *camY, flo
     if (glfwGetKey(window, GLFW_KEY_KP_SUBTRACT) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS)
         *camScale += zoomSpeed;
 
-    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
-    {
-        *shouldMove = !*shouldMove;
-    }
-
     // Reset view when "0" is pressed
     if (glfwGetKey(window, GLFW_KEY_0) == GLFW_PRESS)
     {